@@ -4,6 +4,7 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 QMAKE_CXXFLAGS  += -D__ARCH_QT__
+LIBS += -lpthread
 
 SOURCES += main.c \
     jhash.c \
@@ -13,7 +14,20 @@ SOURCES += main.c \
     rbt.c \
     test_rbt.c \
     test_skiplist.c \
-    skiplist.c
+    skiplist.c \
+    htable.c \
+    test_htable.c \
+    test_ring.c \
+    test_sync.c \
+    test_avltree.c \
+    test_btree.c \
+    memtable.c \
+    test_memtable.c \
+    rbtree.c \
+    timer.c \
+    test_timer.c \
+    prbt.c \
+    test_prbt.c
 
 DISTFILES += \
     Library.pro.user \
@@ -30,4 +44,9 @@ HEADERS += \
     ring.h \
     btree.h \
     rbt.h \
-    skiplist.h
+    skiplist.h \
+    htable.h \
+    memtable.h \
+    rbtree.h \
+    timer.h \
+    prbt.h
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include "avltree.h"
 
 avltree_t *avltree_init(avltree_t *tree, avlnode_cmp_func_t cmp_func, 
@@ -8,7 +9,10 @@ avltree_t *avltree_init(avltree_t *tree, avlnode_cmp_func_t cmp_func,
     tree->cmp_func = cmp_func;
     tree->del_func = del_func;
     tree->travel_func = travel_func;
-    tree->spinlock = 0;
+    spin_init(&tree->spinlock);
+    seqcount_init(&tree->seq);
+
+    return tree;
 }
 
 static void _avltree_destroy(avlnode_t *root, avlnode_del_func_t del_func)
@@ -28,7 +32,9 @@ avltree_t *avltree_destroy(avltree_t *tree)
     _avltree_destroy(tree->root, tree->del_func);
     tree->root = NULL;
     tree->cmp_func = NULL;
-    tree->spinlock = 0;
+    spin_init(&tree->spinlock);
+
+    return tree;
 }
 
 /**************************
@@ -94,215 +100,200 @@ static avlnode_t *_avltree_double_rotate_right(avlnode_t *top, avlnode_t *cent,
 }
 
 /*
-    insert node into tree, and return the new root.
-    in:
-        @root, the tree's root
-        @node, the node which will be inserted
-        @cmp_func, the compare function point
-    out:
-        @retnode, when cmp_func return 0 with the new node and the node exists
-         in the tree. use the new node instead the old node.
-         the old node returns by retnode.
-        @return val, return the new root.
-*/
-static avlnode_t *_avltree_insert(avlnode_t *root, avlnode_t *node, avlnode_cmp_func_t cmp_func, avlnode_t **retnode)
+ * rebalance a node whose children heights differ by 2,
+ * and return the new root of the subtree.
+ * the equal case of the child's children only happens on delete
+ * and must use a single rotation.
+ */
+static avlnode_t *_avltree_rebalance(avlnode_t *root)
 {
-    int val;
-    int hl, hr;
+    avlnode_t *child;
 
-    if (root == NULL) {
-        return node;
+    if (HEIGHT(root->left) > HEIGHT(root->right)) {
+        child = root->left;
+        if (HEIGHT(child->left) >= HEIGHT(child->right)) {
+            return _avltree_single_rotate_left(root, child);
+        } else {
+            return _avltree_double_rotate_left(root, child, child->right);
+        }
+    } else {
+        child = root->right;
+        if (HEIGHT(child->right) >= HEIGHT(child->left)) {
+            return _avltree_single_rotate_right(root, child);
+        } else {
+            return _avltree_double_rotate_right(root, child, child->left);
+        }
     }
+}
+
+/*
+ * walk back along the search path and fix heights.
+ * stack holds the address of the child pointer which points to
+ * each node of the path, so a rotation only rewrites one pointer.
+ * stop as soon as a subtree keeps its height, nodes above it
+ * can not change.
+ */
+static void _avltree_retrace(avlnode_t ***stack, int top)
+{
+    avlnode_t **link, *root, *newroot;
+    int hl, hr, h;
+
+    while (top > 0) {
+        link = stack[--top];
+        root = *link;
 
-    val = cmp_func(node, root);
-    if (val < 0) {
-        root->left = _avltree_insert(root->left, node, cmp_func, retnode);
-        
-        /* make balance */
         hl = HEIGHT(root->left);
         hr = HEIGHT(root->right);
-        
-        if (hl - hr == 2) {
-            val = cmp_func(node, root->left);
-            if (val < 0) {
-                root = _avltree_single_rotate_left(root, root->left);
-            } else {
-                root = _avltree_double_rotate_left(root, root->left, root->left->right);
+
+        if (hl - hr == 2 || hr - hl == 2) {
+            h = root->height;
+            newroot = _avltree_rebalance(root);
+            *link = newroot;
+
+            if ((int)newroot->height == h) {
+                break;
             }
         } else {
-            /* caculate root's height */
-            root->height = MAX(hl, hr) + 1;
-        }
-    } else if (val > 0) {
-        root->right = _avltree_insert(root->right, node, cmp_func, retnode);
-        
-        /* make balance */
-        hl = HEIGHT(root->left);
-        hr = HEIGHT(root->right);
-        
-        if (hr - hl == 2) {
-            val = cmp_func(node, root->right);
-            if (val > 0) {
-                root = _avltree_single_rotate_right(root, root->right);
-            } else {
-                root = _avltree_double_rotate_right(root, root->right, root->right->left);
+            h = MAX(hl, hr) + 1;
+            if ((int)root->height == h) {
+                break;
             }
-        } else {
-            /* caculate root's height */
-            root->height = MAX(hl, hr) + 1;
+            root->height = h;
         }
-    } else {
-        *retnode = root;
     }
-
-    return root;
 }
 
 /*
  * in:  tree, node
  * out: compare the node with the node in the tree, 
- *      if node equal the old node. then insert node,
- *      return the old node.
- *      else return NULL
+ *      if node equal the old node, the tree is not changed
+ *      and the old node is returned.
+ *      else insert node and return NULL
  * */
 avlnode_t *avltree_insert(avltree_t *tree, avlnode_t *node)
 {
-    avlnode_t *retnode = NULL;
+    avlnode_t **stack[AVLTREE_MAX_HEIGHT + 1];
+    avlnode_t **link = &tree->root;
+    avlnode_t *root;
+    int top = 0;
+    int val;
+
+    while ((root = *link) != NULL) {
+        val = tree->cmp_func(node, root);
+        if (val == 0) {
+            return root;
+        }
+
+        stack[top++] = link;
+        link = val < 0 ? &root->left : &root->right;
+    }
 
     node->left = NULL;
     node->right = NULL;
     node->height = 0;
-    tree->root = _avltree_insert(tree->root, node, tree->cmp_func, &retnode);
+    *link = node;
 
-    return retnode;
+    _avltree_retrace(stack, top);
+
+    return NULL;
 }
 
-static avlnode_t *_avltree_delete(avlnode_t *root,
-                                  avlnode_t *node,
-                                  avlnode_cmp_func_t cmp_func,
-                                  avlnode_t **retnode)
+static avlnode_t *_avltree_build(avlnode_t **nodes, long n)
 {
-    int val;
-    int hl, hr;
-    int hrr, hrl;
-    int hll, hlr;
-    avlnode_t *parent, *next;
-    avlnode_t tmp_next;
+    avlnode_t *node;
+    long mid;
 
-    if (root == NULL) {
+    if (n == 0) {
         return NULL;
     }
 
-    val = cmp_func(node, root);
+    mid = n / 2;
+    node = nodes[mid];
+    node->left = _avltree_build(nodes, mid);
+    node->right = _avltree_build(nodes + mid + 1, n - mid - 1);
+    node->height = CALHEIGHT(node);
 
-    if (val < 0) {
-        root->left = _avltree_delete(root->left, node, cmp_func, retnode);
-        /* make balance */
-        hl = HEIGHT(root->left);
-        hr = HEIGHT(root->right);
+    return node;
+}
 
-        if (hr - hl == 2) {
-            hrr = HEIGHT(root->right->right);
-            hrl = HEIGHT(root->right->left);
-            if (hrr >= hrl) {
-                root = _avltree_single_rotate_right(root, root->right);
-            } else {
-                root = _avltree_double_rotate_right(root, root->right, root->right->left);
-            }
-        } else {
-            /* caculate root's height */
-            root->height = MAX(hl, hr) + 1;
-        }
-    } else if (val > 0) {
-        root->right = _avltree_delete(root->right, node, cmp_func, retnode);
+int avltree_build_sorted(avltree_t *tree, avlnode_t **nodes, long n)
+{
+    if (tree->root != NULL) {
+        return -1;
+    }
 
-        /* make balance */
-        hl = HEIGHT(root->left);
-        hr = HEIGHT(root->right);
+    tree->root = _avltree_build(nodes, n);
 
-        if (hl - hr == 2) {
-            hll = HEIGHT(root->left->left);
-            hlr = HEIGHT(root->left->right);
-            if (hll >= hlr) {
-                root = _avltree_single_rotate_left(root, root->left);
-            } else {
-                root = _avltree_double_rotate_left(root, root->left, root->left->right);
-            }
-        } else {
-            /* caculate root's height */
-            root->height = MAX(hl, hr) + 1;
-        }
-    } else {
-        if (root->left == NULL) {
-            *retnode = root;
-            next = root->right;
-            root->right = NULL;
-            root = next;
+    return 0;
+}
 
-            return root;
+/*
+ * delete the node which equal to node from the tree,
+ * return the deleted node or NULL if not found.
+ * when the node has two children, its successor is moved
+ * into its place, the user's nodes are never copied.
+ */
+avlnode_t *avltree_delete(avltree_t *tree, avlnode_t *node)
+{
+    avlnode_t **stack[AVLTREE_MAX_HEIGHT + 1];
+    avlnode_t **link = &tree->root;
+    avlnode_t **slink;
+    avlnode_t *root, *next;
+    int top = 0;
+    int idx;
+    int val;
+
+    while ((root = *link) != NULL) {
+        val = tree->cmp_func(node, root);
+        if (val == 0) {
+            break;
         }
 
-        if (root->right == NULL) {
-            *retnode = root;
-            next = root->left;
-            root->left = NULL;
-            root = next;
+        stack[top++] = link;
+        link = val < 0 ? &root->left : &root->right;
+    }
 
-            return root;
-        }
+    if (root == NULL) {
+        return NULL;
+    }
 
+    if (root->left == NULL) {
+        *link = root->right;
+    } else if (root->right == NULL) {
+        *link = root->left;
+    } else {
         /* find next node which is the min of root->right */
-        parent = NULL;
-        next = root->right;
-        while (next && next->left) {
-            parent = next;
-            next = next->left;
-        }
-
-        /* exchange root and next node */
-        avlnode_copy(&tmp_next, next);
-        avlnode_copy(next, root);
-        avlnode_copy(root, &tmp_next);
+        stack[top++] = link;
+        idx = top;
 
-        /* fix the tree after exchange */
-        if (parent == NULL) {
-            next->right = root;
-        } else {
-            parent->left = root;
+        slink = &root->right;
+        while ((*slink)->left) {
+            stack[top++] = slink;
+            slink = &(*slink)->left;
         }
 
-        /* node become the root, and root become the node will be deleted */
-        node = root;
-        root = next;
+        next = *slink;
+        *slink = next->right;
 
-        root->right = _avltree_delete(root->right, node, cmp_func, retnode);
-        /* make balance, copy from above, and should be modify */
-        hl = HEIGHT(root->left);
-        hr = HEIGHT(root->right);
+        /* next takes the place of root */
+        next->left = root->left;
+        next->right = root->right;
+        next->height = root->height;
+        *link = next;
 
-        if (hl - hr == 2) {
-            hll = HEIGHT(root->left->left);
-            hlr = HEIGHT(root->left->right);
-            if (hll >= hlr) {
-                root = _avltree_single_rotate_left(root, root->left);
-            } else {
-                root = _avltree_double_rotate_left(root, root->left, root->left->right);
-            }
-        } else {
-            /* caculate root's height */
-            root->height = MAX(hl, hr) + 1;
+        /* the path went through root->right which is next->right now */
+        if (top > idx) {
+            stack[idx] = &next->right;
         }
     }
 
-    return root;
-}
+    root->left = NULL;
+    root->right = NULL;
+    root->height = 0;
 
-avlnode_t *avltree_delete(avltree_t *tree, avlnode_t *node)
-{
-    avlnode_t *retnode = NULL;
-    tree->root = _avltree_delete(tree->root, node, tree->cmp_func, &retnode);
+    _avltree_retrace(stack, top);
 
-    return retnode;
+    return root;
 }
 
 
@@ -369,6 +360,44 @@ void avltree_bfs(avltree_t *tree)
     printf("\n");
 }
 
+/* the height of the subtree, keys must be between lo and hi */
+static int _avltree_check(avltree_t *tree, avlnode_t *n,
+        avlnode_t *lo, avlnode_t *hi, int *err)
+{
+    int l, r;
+
+    if (n == NULL || *err)
+        return -1;
+
+    if ((lo && tree->cmp_func(lo, n) >= 0) ||
+            (hi && tree->cmp_func(n, hi) >= 0)) {
+        *err = 1;
+        return -1;
+    }
+
+    l = _avltree_check(tree, n->left, lo, n, err);
+    r = _avltree_check(tree, n->right, n, hi, err);
+    if (*err)
+        return -1;
+
+    if ((int)n->height != MAX(l, r) + 1) {
+        *err = 2;
+    } else if (l - r > 1 || r - l > 1) {
+        *err = 3;
+    }
+
+    return n->height;
+}
+
+int avltree_check(avltree_t *tree)
+{
+    int err = 0;
+
+    _avltree_check(tree, tree->root, NULL, NULL, &err);
+
+    return err;
+}
+
 /*
  * On success return entry's address
  * or return NULL
@@ -415,4 +444,63 @@ avlnode_t *avltree_find_max(avltree_t *tree)
     return root;
 }
 
+avlnode_t *avltree_sync_insert(avltree_t *tree, avlnode_t *node)
+{
+    avlnode_t *retnode;
+
+    spin_lock(&tree->spinlock);
+    write_seqbegin(&tree->seq);
+    retnode = avltree_insert(tree, node);
+    write_seqend(&tree->seq);
+    spin_unlock(&tree->spinlock);
+
+    return retnode;
+}
+
+avlnode_t *avltree_sync_delete(avltree_t *tree, avlnode_t *node)
+{
+    avlnode_t *retnode;
+
+    spin_lock(&tree->spinlock);
+    write_seqbegin(&tree->seq);
+    retnode = avltree_delete(tree, node);
+    write_seqend(&tree->seq);
+    spin_unlock(&tree->spinlock);
+
+    return retnode;
+}
+
+/*
+ * lock free search, retry when the tree has been changed.
+ * a concurrent rotation may show us a broken path, so the
+ * search is bounded by the max height of a valid tree.
+ */
+avlnode_t *avltree_sync_find(avltree_t *tree, avlnode_t *node)
+{
+    avlnode_t *root, *left, *right;
+    uint32_t seq;
+    int retval;
+    int depth;
+
+    for (;;) {
+        seq = read_seqbegin(&tree->seq);
+
+        root = __atomic_load_n(&tree->root, __ATOMIC_RELAXED);
+        for (depth = 0; root && depth < AVLTREE_MAX_HEIGHT; depth++) {
+            retval = tree->cmp_func(node, root);
+            if (retval == 0) {
+                break;
+            }
+
+            /* both children share a cache line, load them and let
+             * the compiler pick one without a branch */
+            left = __atomic_load_n(&root->left, __ATOMIC_RELAXED);
+            right = __atomic_load_n(&root->right, __ATOMIC_RELAXED);
+            root = retval < 0 ? left : right;
+        }
 
+        if (!read_seqretry(&tree->seq, seq) && depth < AVLTREE_MAX_HEIGHT) {
+            return root;
+        }
+    }
+}
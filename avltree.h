@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "stdmacro.h"
+#include "sync.h"
 
 typedef struct avlnode_s {
     struct avlnode_s *left, *right;
@@ -22,7 +23,7 @@ static inline void avlnode_copy(avlnode_t *dst, avlnode_t *src)
     dst->layer = src->layer;
 }
 
-#define HEIGHT(node) ((node) ? ((node)->height) : (-1))
+#define HEIGHT(node) ((node) ? (int)((node)->height) : (-1))
 #define CALHEIGHT(node) ((node) ? (MAX(HEIGHT((node)->left), HEIGHT((node)->right)) + 1) : (-1))
 
 typedef int (*avlnode_cmp_func_t)(avlnode_t *, avlnode_t *);
@@ -34,7 +35,51 @@ typedef struct avltree_s {
     avlnode_cmp_func_t cmp_func;
     avlnode_del_func_t del_func;
     avlnode_travel_func_t travel_func;
-    uint32_t spinlock;
+
+    /* used by avltree_sync_*, writers lock, readers check seq */
+    spinlock_t spinlock;
+    seqcount_t seq;
 } avltree_t;
 
+/* max height of a avl tree, fibonacci(94) overflows 64 bits */
+#define AVLTREE_MAX_HEIGHT 92
+
+avltree_t *avltree_init(avltree_t *tree, avlnode_cmp_func_t cmp_func,
+        avlnode_del_func_t del_func,
+        avlnode_travel_func_t travel_func);
+avltree_t *avltree_destroy(avltree_t *tree);
+
+avlnode_t *avltree_insert(avltree_t *tree, avlnode_t *node);
+
+/*
+ * link n nodes already in key order into an empty tree in O(n),
+ * no cmp_func is called, return -1 if the tree is not empty.
+ */
+int avltree_build_sorted(avltree_t *tree, avlnode_t **nodes, long n);
+
+avlnode_t *avltree_delete(avltree_t *tree, avlnode_t *node);
+avlnode_t *avltree_find(avltree_t *tree, avlnode_t *node);
+avlnode_t *avltree_find_min(avltree_t *tree);
+avlnode_t *avltree_find_max(avltree_t *tree);
+void avltree_bfs(avltree_t *tree);
+
+/*
+ * return 0 if the tree is an avl tree: 1 if the keys are out of
+ * order, 2 if a stored height is wrong, 3 if a node is unbalanced.
+ */
+int avltree_check(avltree_t *tree);
+
+/*
+ * thread safe version.
+ * writers are serialized by the tree spinlock, readers take no lock
+ * and retry when a writer changed the tree during the search.
+ *
+ * Note: a reader may still walk a node which has just been deleted,
+ *       so deleted nodes must not be freed until all the readers
+ *       which started before the delete have finished.
+ */
+avlnode_t *avltree_sync_insert(avltree_t *tree, avlnode_t *node);
+avlnode_t *avltree_sync_delete(avltree_t *tree, avlnode_t *node);
+avlnode_t *avltree_sync_find(avltree_t *tree, avlnode_t *node);
+
 #endif // AVLTREE_H
@@ -1,202 +1,829 @@
 #include "btree.h"
+#include "builtin.h"
+#include <string.h>
+#include <sys/mman.h>
 
-btree_t *btree_init(btree_t *t, bnode_key_cmp_t key_cmp, bnode_travle_t  travel_func)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BTREE_X86 1
+#endif
+
+typedef int (*btree_lower_bound_t)(bnode_t *x, long k);
+static btree_lower_bound_t _btree_lower_bound_func;
+
+btree_t *btree_init(btree_t *t, int degree,
+        bnode_key_cmp_t key_cmp, bnode_travle_t travel_func)
 {
+    if (degree == 0) {
+        degree = BTREE_DEFAULT_DEGREE;
+    }
+
+    if (degree < BTREE_MIN_DEGREE || degree > BTREE_MAX_DEGREE) {
+        return NULL;
+    }
+
+    if (unlikely(_btree_lower_bound_func == NULL)) {
+        btree_search_impl(BTREE_SEARCH_AUTO);
+    }
+
     t->root = NULL;
     t->key_cmp = key_cmp == NULL ?
                 default_bnode_key_cmp : key_cmp;
     t->travel_func = travel_func == NULL ?
                 default_bnode_travle : travel_func;
 
+    t->plus = false;
+    t->degree = degree;
+    t->min_key = degree - 1;
+    t->max_key = degree * 2 - 1;
+    t->max_child = degree * 2;
+
+    t->leaf_size = BTREE_ALIGN(sizeof(bnode_t))
+                 + BTREE_ALIGN(t->max_key * sizeof(long))
+                 + BTREE_ALIGN(t->max_key * sizeof(void *));
+    t->node_size = t->leaf_size
+                 + BTREE_ALIGN(t->max_child * sizeof(bnode_t *));
+
+    t->hugepage = false;
+    memset(t->pool, 0, sizeof(t->pool));
+    t->pool[0].size = t->node_size;
+    t->pool[1].size = t->leaf_size;
+
+    return t;
+}
+
+btree_t *bptree_init(btree_t *t, int degree,
+        bnode_key_cmp_t key_cmp, bnode_travle_t travel_func)
+{
+    if (btree_init(t, degree, key_cmp, travel_func) == NULL) {
+        return NULL;
+    }
+
+    t->plus = true;
+
     return t;
 }
 
+void btree_set_hugepage(btree_t *t, int on)
+{
+    t->hugepage = on;
+}
+
+#define BCHUNK_HEAD_SIZE BTREE_ALIGN(sizeof(bchunk_t))
+
+static bchunk_t *_btree_chunk_alloc(btree_t *t, size_t size)
+{
+    bchunk_t *c;
+    void *p = MAP_FAILED;
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (t->hugepage) {
+        size = (size + BTREE_POOL_HUGE_SIZE - 1)
+            & ~(size_t)(BTREE_POOL_HUGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+        p = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, size, prot, flags, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (p != MAP_FAILED) {
+                madvise(p, size, MADV_HUGEPAGE);
+            }
+#endif
+        }
+    } else {
+        p = mmap(NULL, size, prot, flags, -1, 0);
+    }
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    c = p;
+    c->next = NULL;
+    c->size = size;
+
+    return c;
+}
+
+static void _btree_chunk_free(bchunk_t *c)
+{
+    bchunk_t *next;
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+        munmap(c, c->size);
+    }
+}
+
+/* start cutting a new chunk, a spare one if there is */
+static int _btree_pool_grow(btree_t *t, bpool_t *p)
+{
+    bchunk_t *c = p->spare;
+    size_t size = BCHUNK_HEAD_SIZE + BTREE_POOL_CHUNK_NODES * p->size;
+
+    if (c != NULL) {
+        p->spare = c->next;
+    } else {
+        c = _btree_chunk_alloc(t, size > BTREE_POOL_CHUNK_SIZE ?
+                size : BTREE_POOL_CHUNK_SIZE);
+        if (c == NULL) {
+            return -1;
+        }
+        p->nchunk++;
+    }
+
+    c->next = p->chunk;
+    p->chunk = c;
+    p->cur = (char *)c + BCHUNK_HEAD_SIZE;
+    p->end = (char *)c + c->size;
+
+    return 0;
+}
+
+/* the nodes are never walked, the chunks are released as a whole */
 int btree_destroy(btree_t *t)
 {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        _btree_chunk_free(t->pool[i].chunk);
+        _btree_chunk_free(t->pool[i].spare);
+        t->pool[i].chunk = NULL;
+        t->pool[i].spare = NULL;
+        t->pool[i].free = NULL;
+        t->pool[i].cur = NULL;
+        t->pool[i].end = NULL;
+        t->pool[i].nchunk = 0;
+    }
+    t->root = NULL;
+
     return 0;
 }
 
-static int _btree_search(bnode_t *x, long k,
-                         bnode_t **retn, long *idx)
+void btree_clear(btree_t *t)
+{
+    bchunk_t *c, *next;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        for (c = t->pool[i].chunk; c != NULL; c = next) {
+            next = c->next;
+            c->next = t->pool[i].spare;
+            t->pool[i].spare = c;
+        }
+        t->pool[i].chunk = NULL;
+        t->pool[i].free = NULL;
+        t->pool[i].cur = NULL;
+        t->pool[i].end = NULL;
+    }
+    t->root = NULL;
+}
+
+bnode_t *btree_node_alloc(btree_t *t, int leaf)
+{
+    bpool_t *pool = &t->pool[leaf ? 1 : 0];
+    char *p;
+    bnode_t *x;
+
+    if (pool->free != NULL) {
+        p = pool->free;
+        pool->free = *(void **)p;
+    } else {
+        if (pool->end - pool->cur < (ptrdiff_t)pool->size &&
+                _btree_pool_grow(t, pool) != 0) {
+            return NULL;
+        }
+        p = pool->cur;
+        pool->cur += pool->size;
+    }
+    memset(p, 0, pool->size);
+
+    x = (bnode_t *)p;
+    p += BNODE_KEY_OFFSET;
+    x->key = (long *)p;
+    p += BTREE_ALIGN(t->max_key * sizeof(long));
+    x->value = (void **)p;
+    p += BTREE_ALIGN(t->max_key * sizeof(void *));
+    x->child = leaf ? NULL : (bnode_t **)p;
+
+    x->leaf = leaf;
+
+    return x;
+}
+
+void btree_node_free(btree_t *t, bnode_t *x)
+{
+    bpool_t *pool = &t->pool[x->leaf ? 1 : 0];
+
+    *(void **)x = pool->free;
+    pool->free = x;
+}
+
+/* return the first index whose key is not less than k */
+static int _btree_lower_bound_scalar(bnode_t *x, long k)
 {
     int i;
 
     for (i = 0; i < x->n && k > x->key[i]; i++);
 
+    return i;
+}
+
+#ifdef BTREE_X86
+/*
+ * compare 8 keys per step, the keys less than k are a prefix
+ * of the step, so the lower bound is the trailing ones of the mask.
+ * the key array is sized to whole cache lines, reading a full step
+ * past n is safe, those lanes are masked out.
+ */
+__attribute__((target("avx2")))
+static int _btree_lower_bound_avx2(bnode_t *x, long k)
+{
+    const __m256i kv = _mm256_set1_epi64x(k);
+    unsigned mask;
+    int i;
+
+    for (i = 0; i < x->n; i += 8) {
+        __m256i a = _mm256_load_si256((const __m256i *)&x->key[i]);
+        __m256i b = _mm256_load_si256((const __m256i *)&x->key[i + 4]);
+
+        mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, a)))
+            | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, b))) << 4);
+
+        if (x->n - i < 8) {
+            mask &= (1U << (x->n - i)) - 1;
+        }
+
+        if (mask != 0xFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+
+    return x->n;
+}
+
+__attribute__((target("sse4.2")))
+static int _btree_lower_bound_sse42(bnode_t *x, long k)
+{
+    const __m128i kv = _mm_set1_epi64x(k);
+    unsigned mask;
+    int i, j;
+
+    for (i = 0; i < x->n; i += 8) {
+        mask = 0;
+        for (j = 0; j < 4; j++) {
+            __m128i a = _mm_load_si128((const __m128i *)&x->key[i + j * 2]);
+            mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(kv, a))) << (j * 2);
+        }
+
+        if (x->n - i < 8) {
+            mask &= (1U << (x->n - i)) - 1;
+        }
+
+        if (mask != 0xFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+
+    return x->n;
+}
+#endif
+
+int btree_search_impl(int impl)
+{
+    int best = BTREE_SEARCH_SCALAR;
+
+#ifdef BTREE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        best = BTREE_SEARCH_AVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        best = BTREE_SEARCH_SSE42;
+    }
+#endif
+
+    if (impl == BTREE_SEARCH_AUTO || impl > best) {
+        impl = best;
+    }
+
+    switch (impl) {
+#ifdef BTREE_X86
+    case BTREE_SEARCH_AVX2:
+        _btree_lower_bound_func = _btree_lower_bound_avx2;
+        break;
+    case BTREE_SEARCH_SSE42:
+        _btree_lower_bound_func = _btree_lower_bound_sse42;
+        break;
+#endif
+    default:
+        impl = BTREE_SEARCH_SCALAR;
+        _btree_lower_bound_func = _btree_lower_bound_scalar;
+        break;
+    }
+
+    return impl;
+}
+
+static inline int _btree_lower_bound(bnode_t *x, long k)
+{
+    return _btree_lower_bound_func(x, k);
+}
+
+/* load the header and the first keys of a node in parallel */
+static inline void _btree_prefetch(bnode_t *x)
+{
+    __builtin_prefetch(x);
+    __builtin_prefetch((char *)x + BNODE_KEY_OFFSET);
+    __builtin_prefetch((char *)x + BNODE_KEY_OFFSET + BTREE_CACHE_LINE_SIZE);
+}
+
+/* B+tree routing, keys equal to the separator live on the right */
+static inline int _bptree_child_index(bnode_t *x, long k)
+{
+    int i = _btree_lower_bound(x, k);
+
     if (i < x->n && k == x->key[i]) {
-        *retn = x;
-        *idx = i;
-        return 0;
-    } else {
-        if (x->leaf)
-            return -1;
-        else
-            return _btree_search(x->child[i], k, retn, idx);
+        i++;
+    }
+
+    return i;
+}
+
+/* return the leaf of B+tree which should own k */
+static inline bnode_t *_bptree_find_leaf(bnode_t *x, long k)
+{
+    while (!x->leaf) {
+        x = x->child[_bptree_child_index(x, k)];
+        _btree_prefetch(x);
     }
+
+    return x;
 }
 
 int btree_search(btree_t *t,  long k,
                  bnode_t **retn,  long *idx)
 {
+    bnode_t *x = t->root;
+    int i;
+
     *retn = NULL;
     *idx = 0;
 
-    if (t->root == NULL) {
-        return -1;
+    if (t->plus && x) {
+        x = _bptree_find_leaf(x, k);
     }
 
-    return _btree_search(t->root, k, retn, idx);
+    while (x) {
+        i = _btree_lower_bound(x, k);
+
+        if (i < x->n && k == x->key[i]) {
+            *retn = x;
+            *idx = i;
+            return 0;
+        }
+
+        if (x->leaf) {
+            break;
+        }
+
+        x = x->child[i];
+        _btree_prefetch(x);
+    }
+
+    return -1;
+}
+
+/* move n keys and values from y[j] to x[i] */
+static inline void _btree_move_kv(bnode_t *x, int i, bnode_t *y, int j, int n)
+{
+    memmove(&x->key[i], &y->key[j], n * sizeof(long));
+    memmove(&x->value[i], &y->value[j], n * sizeof(void *));
 }
 
+static inline void _btree_move_child(bnode_t *x, int i, bnode_t *y, int j, int n)
+{
+    memmove(&x->child[i], &y->child[j], n * sizeof(bnode_t *));
+}
+
+/*
+ * split a full leaf y of B+tree into y and z,
+ * y keeps [0, t-2] and z gets [t-1, 2t-2],
+ * the first key of z is copied into x as the separator.
+ */
+static bnode_t *_bptree_splite_leaf(btree_t *t, bnode_t *x, long idx,
+        bnode_t *y, bnode_t *z)
+{
+    int d = t->degree;
+
+    _btree_move_kv(z, 0, y, d - 1, d);
+    z->n = d;
+    y->n = d - 1;
+
+    z->next_leaf = y->next_leaf;
+    z->prev_leaf = y;
+    if (y->next_leaf) {
+        y->next_leaf->prev_leaf = z;
+    }
+    y->next_leaf = z;
+
+    _btree_move_kv(x, idx + 1, x, idx, x->n - idx);
+    x->key[idx] = z->key[0];
+    x->value[idx] = NULL;
+
+    _btree_move_child(x, idx + 2, x, idx + 1, x->n - idx);
+    x->child[idx + 1] = z;
+
+    x->n++;
+    return x;
+}
 
 /* make bnode not full */
 /* x is not full, x.child[idx] is full */
-bnode_t *btree_splite_child(bnode_t *x, long idx)
+bnode_t *btree_splite_child(btree_t *t, bnode_t *x, long idx)
 {
     bnode_t *y = x->child[idx];
-    bnode_t *z = calloc(1, sizeof(bnode_t));
-    int i = 0;
+    bnode_t *z = btree_node_alloc(t, y->leaf);
+    int d = t->degree;
 
-    /*finish z*//* [0, t-2][t-1][t, 2t-2] */
-    for (i = 0; i < BTREE_MAX_DEGREE - 1; i++) {
-        z->key[i] = y->key[i + BTREE_MAX_DEGREE];
+    if (z == NULL) {
+        return NULL;
     }
 
-    if (!y->leaf) {
-        for (i = 0; i < BTREE_MAX_DEGREE; i++) {
-            z->child[i] = y->child[i + BTREE_MAX_DEGREE];
-        }
+    if (t->plus && y->leaf) {
+        return _bptree_splite_leaf(t, x, idx, y, z);
     }
 
-    z->leaf = y->leaf;
-    z->n = BTREE_MAX_DEGREE - 1;
+    /*finish z*//* [0, t-2][t-1][t, 2t-2] */
+    _btree_move_kv(z, 0, y, d, d - 1);
+    if (!y->leaf) {
+        _btree_move_child(z, 0, y, d, d);
+    }
+    z->n = d - 1;
 
     /*finish y*/
-    y->n = BTREE_MAX_DEGREE - 1;
+    y->n = d - 1;
 
     /*finish x*/
-    for (i = x->n - 1; i >= idx; i--) {
-        x->key[i+1] = x->key[i];
-    }
-    x->key[idx] = y->key[BTREE_MAX_DEGREE-1];
+    _btree_move_kv(x, idx + 1, x, idx, x->n - idx);
+    x->key[idx] = y->key[d - 1];
+    x->value[idx] = y->value[d - 1];
 
-    for (i = x->n; i >= idx + 1; i--) {
-        x->child[i+1] = x->child[i];
-    }
-    x->child[idx+1] = z;
+    _btree_move_child(x, idx + 2, x, idx + 1, x->n - idx);
+    x->child[idx + 1] = z;
 
     x->n++;
     return x;
 }
 
 /* insert k into a tree which is not full */
-int btree_insert_not_full(bnode_t *n, long k)
+static int _btree_insert_not_full(btree_t *t, bnode_t *x, long k, void *v)
 {
     int i;
 
-    if (n->leaf) {
-        for (i = n->n - 1; i >= 0 && k < n->key[i]; i--) {
-            n->key[i+1] = n->key[i];
+    for (;;) {
+        i = _btree_lower_bound(x, k);
+
+        if (i < x->n && k == x->key[i]) {
+            x->value[i] = v;
+            return 1;
         }
-        i++;
-        n->key[i] = k;
-        n->n++;
-    } else {
-        for (i = 0; i < n->n && k > n->key[i]; i++);
-        if (n->child[i]->n == BTREE_MAX_KEY) {
-            btree_splite_child(n, i);
-            if (k > n->key[i])
+
+        if (x->leaf) {
+            _btree_move_kv(x, i + 1, x, i, x->n - i);
+            x->key[i] = k;
+            x->value[i] = v;
+            x->n++;
+            return 0;
+        }
+
+        if (x->child[i]->n == t->max_key) {
+            if (btree_splite_child(t, x, i) == NULL) {
+                return -1;
+            }
+
+            if (k == x->key[i]) {
+                x->value[i] = v;
+                return 1;
+            } else if (k > x->key[i]) {
+                i++;
+            }
+        }
+
+        x = x->child[i];
+    }
+}
+
+/* insert k into a B+tree which is not full */
+static int _bptree_insert_not_full(btree_t *t, bnode_t *x, long k, void *v)
+{
+    int i;
+
+    while (!x->leaf) {
+        i = _bptree_child_index(x, k);
+
+        if (x->child[i]->n == t->max_key) {
+            if (btree_splite_child(t, x, i) == NULL) {
+                return -1;
+            }
+
+            if (k >= x->key[i]) {
                 i++;
+            }
         }
-        btree_insert_not_full(n->child[i], k);
+
+        x = x->child[i];
     }
+
+    i = _btree_lower_bound(x, k);
+    if (i < x->n && k == x->key[i]) {
+        x->value[i] = v;
+        return 1;
+    }
+
+    _btree_move_kv(x, i + 1, x, i, x->n - i);
+    x->key[i] = k;
+    x->value[i] = v;
+    x->n++;
+
+    return 0;
 }
 
 /* insert k into a tree which maybe full */
-int btree_insert(btree_t *t, long k)
+int btree_insert(btree_t *t, long k, void *v)
 {
     bnode_t *n;
 
     if (t->root == NULL) {
-        t->root = calloc(1, sizeof(bnode_t));
-        t->root->leaf = true;
+        t->root = btree_node_alloc(t, true);
+        if (t->root == NULL) {
+            return -1;
+        }
         t->root->key[0] = k;
+        t->root->value[0] = v;
         t->root->n = 1;
         return 0;
     }
-    else if (t->root->n == BTREE_MAX_KEY) {
-        n = calloc(1, sizeof(bnode_t));
+    else if (t->root->n == t->max_key) {
+        n = btree_node_alloc(t, false);
+        if (n == NULL) {
+            return -1;
+        }
         n->n = 0;
-        n->leaf = false;
         n->child[0] = t->root;
+        if (btree_splite_child(t, n, 0) == NULL) {
+            btree_node_free(t, n);
+            return -1;
+        }
         t->root = n;
-        btree_splite_child(n, 0);
     }
 
-    btree_insert_not_full(t->root, k);
-    return 0;
+    if (t->plus) {
+        return _bptree_insert_not_full(t, t->root, k, v);
+    }
+
+    return _btree_insert_not_full(t, t->root, k, v);
 }
 
-long btree_find_min(bnode_t *x)
+static void _btree_free_subtree(btree_t *t, bnode_t *x)
 {
-    if (x == NULL) {
+    int i;
+
+    if (!x->leaf) {
+        for (i = 0; i <= x->n; i++) {
+            _btree_free_subtree(t, x->child[i]);
+        }
+    }
+    btree_node_free(t, x);
+}
+
+/*
+ * number of groups to cut n units into, each group gets about per
+ * units and never less than min, the last group is not left short.
+ */
+static long _btree_bulk_groups(long n, long per, long min)
+{
+    long m = (n + per - 1) / per;
+
+    if (m > n / min) {
+        m = n / min;
+    }
+
+    return m < 1 ? 1 : m;
+}
+
+/*
+ * build the tree bottom up in one pass over the sorted input:
+ * cut the keys into leaves, the keys between two leaves (classic)
+ * or the first key of each leaf (B+tree) are the separators of
+ * the level above, then cut each level into parents the same way
+ * until one node is left.
+ */
+int btree_bulk_load(btree_t *t, const long *keys, void *const *values,
+        long n, int fill)
+{
+    bnode_t **nodes;
+    bnode_t *x, *prev = NULL;
+    long *sk;
+    void **sv;
+    long m, p, i, j, c, pos, total, base, extra, per;
+
+    if (t->root != NULL || n < 0) {
         return -1;
     }
 
+    for (i = 1; i < n; i++) {
+        if (keys[i] <= keys[i - 1]) {
+            return -1;
+        }
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    if (fill <= 0 || fill > 100) {
+        fill = 100;
+    }
+    per = (long)t->max_key * fill / 100;
+    if (per < t->min_key) {
+        per = t->min_key;
+    }
+    if (per < 1) {
+        per = 1;
+    }
+
+    /* classic leaves give up one key per gap to the level above */
+    if (t->plus) {
+        m = _btree_bulk_groups(n, per, t->min_key);
+        total = n;
+    } else {
+        m = _btree_bulk_groups(n + 1, per + 1, t->min_key + 1);
+        total = n - m + 1;
+    }
+
+    nodes = malloc(m * sizeof(bnode_t *));
+    sk = malloc(m * sizeof(long));
+    sv = malloc(m * sizeof(void *));
+    if (nodes == NULL || sk == NULL || sv == NULL) {
+        free(nodes);
+        free(sk);
+        free(sv);
+        return -1;
+    }
+
+    base = total / m;
+    extra = total % m;
+    pos = 0;
+    for (i = 0; i < m; i++) {
+        x = btree_node_alloc(t, true);
+        if (x == NULL) {
+            for (j = 0; j < i; j++) {
+                btree_node_free(t, nodes[j]);
+            }
+            goto err;
+        }
+
+        c = base + (i < extra);
+        memcpy(x->key, &keys[pos], c * sizeof(long));
+        if (values != NULL) {
+            memcpy(x->value, &values[pos], c * sizeof(void *));
+        }
+        x->n = c;
+        pos += c;
+
+        if (t->plus) {
+            x->prev_leaf = prev;
+            if (prev != NULL) {
+                prev->next_leaf = x;
+                sk[i - 1] = x->key[0];
+                sv[i - 1] = NULL;
+            }
+            prev = x;
+        } else if (i < m - 1) {
+            sk[i] = keys[pos];
+            sv[i] = values != NULL ? values[pos] : NULL;
+            pos++;
+        }
+        nodes[i] = x;
+    }
+
+    /*
+     * a parent with c children takes the c - 1 separators between them,
+     * the separator between two parents moves up. the level is rebuilt
+     * in place, it only writes the slots it has already consumed.
+     */
+    while (m > 1) {
+        p = _btree_bulk_groups(m, per + 1, t->degree);
+        base = m / p;
+        extra = m % p;
+        pos = 0;
+        for (j = 0; j < p; j++) {
+            x = btree_node_alloc(t, false);
+            if (x == NULL) {
+                for (i = 0; i < j; i++) {
+                    _btree_free_subtree(t, nodes[i]);
+                }
+                for (i = pos; i < m; i++) {
+                    _btree_free_subtree(t, nodes[i]);
+                }
+                goto err;
+            }
+
+            c = base + (j < extra);
+            memcpy(x->child, &nodes[pos], c * sizeof(bnode_t *));
+            memcpy(x->key, &sk[pos], (c - 1) * sizeof(long));
+            memcpy(x->value, &sv[pos], (c - 1) * sizeof(void *));
+            x->n = c - 1;
+            pos += c;
+
+            nodes[j] = x;
+            if (j < p - 1) {
+                sk[j] = sk[pos - 1];
+                sv[j] = sv[pos - 1];
+            }
+        }
+        m = p;
+    }
+
+    t->root = nodes[0];
+    free(nodes);
+    free(sk);
+    free(sv);
+    return 0;
+
+err:
+    free(nodes);
+    free(sk);
+    free(sv);
+    return -1;
+}
+
+static bnode_t *_btree_min_node(bnode_t *x)
+{
     while (!x->leaf) {
         x = x->child[0];
     }
 
-    return x->key[0];
+    return x;
 }
 
-long btree_find_max(bnode_t *x)
+static bnode_t *_btree_max_node(bnode_t *x)
+{
+    while (!x->leaf) {
+        x = x->child[x->n];
+    }
+
+    return x;
+}
+
+long btree_find_min(bnode_t *x)
 {
     if (x == NULL) {
         return -1;
     }
 
-    while (!x->leaf) {
-        x = x->child[x->n];
+    return _btree_min_node(x)->key[0];
+}
+
+long btree_find_max(bnode_t *x)
+{
+    if (x == NULL) {
+        return -1;
     }
 
+    x = _btree_max_node(x);
     return x->key[x->n - 1];
 }
 
 /* x own enough keys which at least t,
  * x.c[idx] and x.c[idx+1] both have t-1 keys
  */
-int btree_merge_child(bnode_t *x, long idx)
+int btree_merge_child(btree_t *t, bnode_t *x, long idx)
 {
     bnode_t *y = x->child[idx];
     bnode_t *z = x->child[idx + 1];
-    int i;
 
     /* modify y */
-    for (i = 0; i < z->n + 1; i++) {
-        y->child[y->n + 1 + i] = z->child[i];
+    if (!y->leaf) {
+        _btree_move_child(y, y->n + 1, z, 0, z->n + 1);
     }
 
     y->key[y->n] = x->key[idx];
+    y->value[y->n] = x->value[idx];
     y->n++;
 
-    for (i = 0; i < z->n; i++) {
-        y->key[y->n + i] = z->key[i];
-    }
+    _btree_move_kv(y, y->n, z, 0, z->n);
     y->n += z->n;
 
     /* mofify x */
-    for (i = idx+1; i < x->n; i++) {
-        x->key[i-1] = x->key[i];
-    }
-
-    for (i = idx + 2; i < x->n + 1; i++) {
-        x->child[i-1] = x->child[i];
-    }
+    _btree_move_kv(x, idx, x, idx + 1, x->n - idx - 1);
+    _btree_move_child(x, idx + 1, x, idx + 2, x->n - idx - 1);
     x->n--;
 
     /* free z */
-    free(z);
+    btree_node_free(t, z);
 
     return 0;
 }
@@ -204,26 +831,22 @@ int btree_merge_child(bnode_t *x, long idx)
 
 int btree_stole_left(bnode_t *x, long idx)
 {
-    int i;
     bnode_t *c = x->child[idx];
     bnode_t *l = x->child[idx - 1];
 
     /*make space in c*/
-    for (i = c->n-1; i >= 0; i--) {
-        c->key[i+1] = c->key[i];
-    }
-
+    _btree_move_kv(c, 1, c, 0, c->n);
     if (!c->leaf) {
-        for (i = c->n; i >= 0; i--) {
-            c->child[i+1] = c->child[i];
-        }
+        _btree_move_child(c, 1, c, 0, c->n + 1);
+        c->child[0] = l->child[l->n];
     }
 
     c->key[0] = x->key[idx-1];
-    c->child[0] = l->child[l->n];
+    c->value[0] = x->value[idx-1];
     c->n++;
 
     x->key[idx-1] = l->key[l->n - 1];
+    x->value[idx-1] = l->value[l->n - 1];
 
     l->n--;
 
@@ -232,162 +855,343 @@ int btree_stole_left(bnode_t *x, long idx)
 
 int btree_stole_right(bnode_t *x, long idx)
 {
-    int i;
     bnode_t *c = x->child[idx];
     bnode_t *r = x->child[idx + 1];
 
     /*make space in c*/
     c->key[c->n] = x->key[idx];
-    c->child[c->n+1] = r->child[0];
+    c->value[c->n] = x->value[idx];
+    if (!c->leaf) {
+        c->child[c->n+1] = r->child[0];
+    }
     c->n++;
 
     x->key[idx] = r->key[0];
+    x->value[idx] = r->value[0];
 
-    for (i = 1; i < r->n; i++) {
-        r->key[i-1] = r->key[i];
-    }
-    for (i = 1; i < r->n + 1; i++) {
-        r->child[i-1] = r->child[i];
+    _btree_move_kv(r, 0, r, 1, r->n - 1);
+    if (!r->leaf) {
+        _btree_move_child(r, 0, r, 1, r->n);
     }
     r->n--;
 
     return 0;
 }
 
-/* delete k from tree which own enough keys */
-int btree_delete_enough(bnode_t *x, long k)
+/*
+ * delete k from the subtree x,
+ * every node we step into owns at least degree keys
+ * except x itself which is the root.
+ */
+static int _btree_delete(btree_t *t, bnode_t *x, long k)
 {
+    bnode_t *y;
     int i;
-    int j;
-    long kk;
-    int found = false;
 
-    for (i = 0; i < x->n && k > x->key[i]; i++);
+    for (;;) {
+        i = _btree_lower_bound(x, k);
 
-    found = (i < x->n && k == x->key[i]) ? true : false;
-
-    if (found) {
-        if (x->leaf) {
-            for (j = i+1; j < x->n; j++) {
-                x->key[j-1] = x->key[j];
+        if (i < x->n && k == x->key[i]) {
+            if (x->leaf) {
+                _btree_move_kv(x, i, x, i + 1, x->n - i - 1);
+                x->n--;
+                return 0;
             }
-            x->n--;
-        } else {
-            if (x->child[i]->n >= BTREE_MAX_DEGREE) {
-                kk = btree_find_max(x->child[i]);
-                x->key[i] = kk;
-                btree_delete_enough(x->child[i], kk);
-            } else if (x->child[i+1]->n >= BTREE_MAX_DEGREE) {
-                kk = btree_find_min(x->child[i+1]);
-                x->key[i] = kk;
-                btree_delete_enough(x->child[i+1], kk);
+
+            if (x->child[i]->n > t->min_key) {
+                /* replace k with its predecessor */
+                y = _btree_max_node(x->child[i]);
+                k = y->key[y->n - 1];
+                x->key[i] = k;
+                x->value[i] = y->value[y->n - 1];
+            } else if (x->child[i+1]->n > t->min_key) {
+                /* replace k with its successor */
+                y = _btree_min_node(x->child[i+1]);
+                k = y->key[0];
+                x->key[i] = k;
+                x->value[i] = y->value[0];
+                i++;
             } else {
-                btree_merge_child(x, i);
-                btree_delete_enough(x->child[i], k);
+                btree_merge_child(t, x, i);
             }
-        }
-    } else if (!x->leaf) {
-        if (x->child[i]->n == BTREE_MIN_KEY) {
-            if (i >= 1 && x->child[i-1]->n >= BTREE_MAX_DEGREE) {
+        } else if (x->leaf) {
+            return -1;
+        } else if (x->child[i]->n == t->min_key) {
+            if (i >= 1 && x->child[i-1]->n > t->min_key) {
                 //stole from left brother
                 btree_stole_left(x, i);
-                btree_delete_enough(x->child[i], k);
-            } else if (i < x->n && x->child[i+1]->n >= BTREE_MAX_DEGREE) {
+            } else if (i < x->n && x->child[i+1]->n > t->min_key) {
                 //stole from right brother
                 btree_stole_right(x, i);
-                btree_delete_enough(x->child[i], k);
             } else {
                 if (i == x->n)
                     i--;
-                btree_merge_child(x, i);
-                btree_delete_enough(x->child[i], k);
+                btree_merge_child(t, x, i);
             }
-        } else {
-            btree_delete_enough(x->child[i], k);
         }
+
+        x = x->child[i];
     }
+}
 
-    return 0;
+/*
+ * B+tree rebalance of x.child[idx] which owns only t-1 keys,
+ * leaves do not pull the separator down, they move records
+ * directly and refresh the separator.
+ */
+static void _bptree_stole_left(bnode_t *x, long idx)
+{
+    bnode_t *c = x->child[idx];
+    bnode_t *l = x->child[idx - 1];
+
+    _btree_move_kv(c, 1, c, 0, c->n);
+    c->key[0] = l->key[l->n - 1];
+    c->value[0] = l->value[l->n - 1];
+    c->n++;
+    l->n--;
+
+    x->key[idx - 1] = c->key[0];
 }
 
-/* delete k from tree which maybe not have enough keys */
-int btree_delete(btree_t *t, long k)
+static void _bptree_stole_right(bnode_t *x, long idx)
 {
-    int i, j;
-    bnode_t *x = t->root;
-    int found;
-    long kk;
+    bnode_t *c = x->child[idx];
+    bnode_t *r = x->child[idx + 1];
 
-    if (t->root == NULL) {
-        return -1;
-    } else if (t->root->n <= BTREE_MIN_KEY) {
-        for (i = 0; i < x->n && k > x->key[i]; i++);
-        found = (i < x->n && k == x->key[i]) ? true : false;
-        if (found) {
-            if (x->leaf) {
-                for (j = i+1; j < x->n; j++) {
-                    x->key[j-1] = x->key[j];
-                }
-                x->n--;
-                if (x->n == 0) {
-                    free(x);
-                    t->root = NULL;
-                }
-            } else {
-                if (x->child[i]->n >= BTREE_MAX_DEGREE) {
-                    kk = btree_find_max(x->child[i]);
-                    x->key[i] = kk;
-                    btree_delete_enough(x->child[i], kk);
-                } else if (x->child[i+1]->n >= BTREE_MAX_DEGREE) {
-                    kk = btree_find_min(x->child[i+1]);
-                    x->key[i] = kk;
-                    btree_delete_enough(x->child[i+1], kk);
-                } else {
-                    btree_merge_child(x, i);
-                    if (x->n == 0) {
-                        t->root = x->child[0];
-                        free(x);
-                    }
-                    btree_delete_enough(t->root, k);
-                }
-            }
-        } else if (!x->leaf) {
-            if (x->child[i]->n == BTREE_MIN_KEY) {
-                if (i >= 1 && x->child[i-1]->n >= BTREE_MAX_DEGREE) {
-                    //stole from left brother
+    c->key[c->n] = r->key[0];
+    c->value[c->n] = r->value[0];
+    c->n++;
+
+    _btree_move_kv(r, 0, r, 1, r->n - 1);
+    r->n--;
+
+    x->key[idx] = r->key[0];
+}
+
+static void _bptree_merge_leaf(btree_t *t, bnode_t *x, long idx)
+{
+    bnode_t *y = x->child[idx];
+    bnode_t *z = x->child[idx + 1];
+
+    _btree_move_kv(y, y->n, z, 0, z->n);
+    y->n += z->n;
+
+    y->next_leaf = z->next_leaf;
+    if (z->next_leaf) {
+        z->next_leaf->prev_leaf = y;
+    }
+
+    _btree_move_kv(x, idx, x, idx + 1, x->n - idx - 1);
+    _btree_move_child(x, idx + 1, x, idx + 2, x->n - idx - 1);
+    x->n--;
+
+    btree_node_free(t, z);
+}
+
+static int _bptree_delete(btree_t *t, bnode_t *x, long k)
+{
+    bnode_t *c;
+    int i;
+
+    while (!x->leaf) {
+        i = _bptree_child_index(x, k);
+        c = x->child[i];
+
+        if (c->n == t->min_key) {
+            if (i >= 1 && x->child[i-1]->n > t->min_key) {
+                if (c->leaf)
+                    _bptree_stole_left(x, i);
+                else
                     btree_stole_left(x, i);
-                    btree_delete_enough(x->child[i], k);
-                } else if (i < x->n && x->child[i+1]->n >= BTREE_MAX_DEGREE) {
-                    //stole from right brother
+            } else if (i < x->n && x->child[i+1]->n > t->min_key) {
+                if (c->leaf)
+                    _bptree_stole_right(x, i);
+                else
                     btree_stole_right(x, i);
-                    btree_delete_enough(x->child[i], k);
-                } else {
-                    if (i == x->n)
-                        i--;
-                    btree_merge_child(x, i);
-                    if (x->n == 0) {
-                        t->root = x->child[0];
-                        free(x);
-                    }
-                    btree_delete_enough(t->root, k);
-                }
             } else {
-                btree_delete_enough(x->child[i], k);
+                if (i == x->n)
+                    i--;
+                if (c->leaf)
+                    _bptree_merge_leaf(t, x, i);
+                else
+                    btree_merge_child(t, x, i);
             }
         }
-    } else {
-        btree_delete_enough(t->root, k);
+
+        x = x->child[i];
+    }
+
+    i = _btree_lower_bound(x, k);
+    if (i == x->n || k != x->key[i]) {
+        return -1;
     }
 
+    _btree_move_kv(x, i, x, i + 1, x->n - i - 1);
+    x->n--;
+
     return 0;
 }
 
+/* delete k from tree, return -1 if not found */
+int btree_delete(btree_t *t, long k)
+{
+    bnode_t *x = t->root;
+    int ret;
+
+    if (x == NULL) {
+        return -1;
+    }
+
+    if (t->plus)
+        ret = _bptree_delete(t, x, k);
+    else
+        ret = _btree_delete(t, x, k);
+
+    /* root lost its last key */
+    if (x->n == 0) {
+        t->root = x->leaf ? NULL : x->child[0];
+        btree_node_free(t, x);
+    }
+
+    return ret;
+}
+
+
+int btree_cursor_seek(btree_t *t, btree_cursor_t *c, long k)
+{
+    bnode_t *x;
+
+    c->node = NULL;
+    c->idx = 0;
+
+    if (!t->plus || t->root == NULL) {
+        return -1;
+    }
+
+    x = _bptree_find_leaf(t->root, k);
+    c->idx = _btree_lower_bound(x, k);
+    c->node = x;
+
+    if (c->idx == x->n) {
+        c->node = x->next_leaf;
+        c->idx = 0;
+    }
+
+    return c->node ? 0 : -1;
+}
+
+int btree_cursor_first(btree_t *t, btree_cursor_t *c)
+{
+    c->node = NULL;
+    c->idx = 0;
+
+    if (!t->plus || t->root == NULL) {
+        return -1;
+    }
+
+    c->node = _btree_min_node(t->root);
+
+    return 0;
+}
+
+int btree_cursor_last(btree_t *t, btree_cursor_t *c)
+{
+    c->node = NULL;
+    c->idx = 0;
+
+    if (!t->plus || t->root == NULL) {
+        return -1;
+    }
+
+    c->node = _btree_max_node(t->root);
+    c->idx = c->node->n - 1;
+
+    return 0;
+}
+
+int btree_cursor_next(btree_cursor_t *c)
+{
+    if (c->node == NULL) {
+        return -1;
+    }
+
+    if (++c->idx == c->node->n) {
+        c->node = c->node->next_leaf;
+        c->idx = 0;
+    }
+
+    return c->node ? 0 : -1;
+}
+
+int btree_cursor_prev(btree_cursor_t *c)
+{
+    if (c->node == NULL) {
+        return -1;
+    }
+
+    if (c->idx-- == 0) {
+        c->node = c->node->prev_leaf;
+        c->idx = c->node ? c->node->n - 1 : 0;
+    }
+
+    return c->node ? 0 : -1;
+}
+
+int btree_cursor_get(btree_cursor_t *c, long *k, void **v)
+{
+    if (c->node == NULL) {
+        return -1;
+    }
+
+    if (k)
+        *k = c->node->key[c->idx];
+    if (v)
+        *v = c->node->value[c->idx];
+
+    return 0;
+}
+
+int btree_cursor_fetch(btree_cursor_t *c, long *keys, void **values, int n)
+{
+    bnode_t *x;
+    int got = 0;
+    int m;
+
+    while (got < n && (x = c->node) != NULL) {
+        /* start loading the next leaf while copying this one */
+        if (x->next_leaf) {
+            __builtin_prefetch(x->next_leaf->key);
+        }
+
+        m = x->n - c->idx;
+        if (m > n - got) {
+            m = n - got;
+        }
+
+        memcpy(&keys[got], &x->key[c->idx], m * sizeof(long));
+        if (values) {
+            memcpy(&values[got], &x->value[c->idx], m * sizeof(void *));
+        }
+
+        got += m;
+        c->idx += m;
+
+        if (c->idx == x->n) {
+            c->node = x->next_leaf;
+            c->idx = 0;
+        }
+    }
+
+    return got;
+}
 
 /* queue with btree node */
 int btinitqueue(bnode_t *queue)
 {
     queue->next = queue;
     queue->prev = queue;
+
+    return 0;
 }
 
 int btenqueue(bnode_t *queue, bnode_t *node)
@@ -398,6 +1202,8 @@ int btenqueue(bnode_t *queue, bnode_t *node)
         queue->next->prev = node;
         queue->next = node;
     }
+
+    return 0;
 }
 
 bnode_t *btdequeue(bnode_t *queue)
@@ -443,18 +1249,3 @@ void btree_bfs(btree_t *tree)
 
     printf("\n");
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -1,16 +1,27 @@
 #ifndef BTREE_H
 #define BTREE_H
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-#define BTREE_MAX_DEGREE 4
+/*
+ * degree is the minimum degree of CLRS B-tree:
+ *     every node except root owns at least degree - 1 keys,
+ *     and at most 2 * degree - 1 keys and 2 * degree children.
+ * it is chosen at btree_init, 0 means BTREE_DEFAULT_DEGREE.
+ */
+#define BTREE_DEFAULT_DEGREE    32      /* fanout 64, the fastest in test_btree */
+#define BTREE_MIN_DEGREE        2
+#define BTREE_MAX_DEGREE        1024
 
-#define BTREE_MIN_KEY   ((BTREE_MAX_DEGREE) - 1)
-#define BTREE_MAX_KEY   ((BTREE_MAX_DEGREE) * 2 - 1)
-#define BTREE_MIN_CHILD (BTREE_MAX_DEGREE)
-#define BTREE_MAX_CHILD ((BTREE_MAX_DEGREE) * 2)
+#define BTREE_CACHE_LINE_SIZE   64
+#define BTREE_ALIGN(size) \
+    (((size) + BTREE_CACHE_LINE_SIZE - 1) & ~(BTREE_CACHE_LINE_SIZE - 1))
+
+/* offset of the key array in a node */
+#define BNODE_KEY_OFFSET BTREE_ALIGN(sizeof(bnode_t))
 
 struct bnode_s;
 typedef struct bnode_s bnode_t;
@@ -18,22 +29,73 @@ typedef struct bnode_s bnode_t;
 typedef void (*bnode_travle_t)(bnode_t *node);
 typedef int (*bnode_key_cmp_t)(long ka, long kb);
 
-
+/*
+ * a node is one allocation:
+ *
+ *  |header|key[max_key]|value[max_key]|child[max_child]|
+ *
+ * every part starts on a cache line, so a key scan never touches
+ * the values or the children, leaves have no child array.
+ */
 struct bnode_s {
     int n;
-    int leaf;
-    long key[BTREE_MAX_KEY];
-    bnode_t *child[BTREE_MAX_CHILD];
+    short leaf;
+    short layer;
+
+    long *key;
+    void **value;
+    bnode_t **child;
 
+    /* bfs queue */
     bnode_t *prev;
     bnode_t *next;
-    int layer;
-};
+
+    /* leaf chain of B+tree */
+    bnode_t *prev_leaf;
+    bnode_t *next_leaf;
+} __attribute__((aligned(BTREE_CACHE_LINE_SIZE)));
+
+/*
+ * node pool of one size class, leaves and internal nodes have
+ * their own class. nodes are cut from big chunks by bumping cur,
+ * a freed node goes on the free list linked through its first word.
+ * the chunks are only given back by btree_destroy.
+ */
+#define BTREE_POOL_CHUNK_SIZE   (256 * 1024)
+#define BTREE_POOL_CHUNK_NODES  8
+#define BTREE_POOL_HUGE_SIZE    (2 * 1024 * 1024)
+
+typedef struct bchunk_s {
+    struct bchunk_s *next;
+    size_t size;
+} bchunk_t;
+
+typedef struct bpool_s {
+    size_t size;        /* node size */
+    void *free;
+    bchunk_t *chunk;    /* chunks in use, the first one is being cut */
+    bchunk_t *spare;    /* chunks emptied by btree_clear */
+    char *cur;
+    char *end;
+    long nchunk;
+} bpool_t;
 
 typedef struct btree_s {
     bnode_t *root;
     bnode_key_cmp_t key_cmp;
     bnode_travle_t  travel_func;
+
+    int plus;   /* B+tree, see bptree_init */
+    int degree;
+    int min_key;
+    int max_key;
+    int max_child;
+
+    size_t leaf_size;
+    size_t node_size;
+
+    int hugepage;
+    bpool_t pool[2];    /* [0] internal nodes, [1] leaves */
 } btree_t;
 
 static inline int default_bnode_key_cmp(long ka, long kb)
@@ -53,22 +115,100 @@ static inline void default_bnode_travle(bnode_t *node)
     }
 }
 
-btree_t *btree_init(btree_t *t, bnode_key_cmp_t key_cmp, bnode_travle_t  travel_func);
-bnode_t *btree_splite_child(bnode_t *x, long idx);
-
-int btree_insert(btree_t *t, long k);
+btree_t *btree_init(btree_t *t, int degree,
+        bnode_key_cmp_t key_cmp, bnode_travle_t travel_func);
+
+/*
+ * B+tree mode, all the records live in the leaves and the leaves
+ * are chained by prev_leaf/next_leaf, internal keys only route.
+ * btree_insert/btree_delete/btree_search work on both modes,
+ * the cursor api needs this mode.
+ */
+btree_t *bptree_init(btree_t *t, int degree,
+        bnode_key_cmp_t key_cmp, bnode_travle_t travel_func);
+
+/*
+ * back the node pool by 2M huge pages, MAP_HUGETLB first and
+ * transparent huge pages when none is reserved.
+ * call it before the first insert.
+ */
+void btree_set_hugepage(btree_t *t, int on);
+
+/* free all the nodes and give the chunks back, the tree stays usable */
+int btree_destroy(btree_t *t);
+
+/* drop all the nodes but keep the chunks for the next build */
+void btree_clear(btree_t *t);
+
+bnode_t *btree_node_alloc(btree_t *t, int leaf);
+void btree_node_free(btree_t *t, bnode_t *x);
+
+bnode_t *btree_splite_child(btree_t *t, bnode_t *x, long idx);
+
+/* insert k with value v, if k exists its value is replaced and return 1 */
+int btree_insert(btree_t *t, long k, void *v);
+
+/*
+ * build an empty tree from n strictly ascending keys in O(n),
+ * values may be NULL. fill is the percent of max_key put in a node,
+ * leave room for later inserts with a lower fill, 0 means 100.
+ * works on both modes, B+tree leaves come out chained.
+ * return -1 if the tree is not empty, the keys are not ascending
+ * or out of memory.
+ */
+int btree_bulk_load(btree_t *t, const long *keys, void *const *values,
+        long n, int fill);
 
 long btree_find_max(bnode_t *x);
 long btree_find_min(bnode_t *x);
-int btree_merge_child(bnode_t *x, long idx);
+int btree_merge_child(btree_t *t, bnode_t *x, long idx);
 int btree_stole_right(bnode_t *x, long idx);
 int btree_stole_left(bnode_t *x, long idx);
 
 int btree_delete(btree_t *t, long k);
 
+/* on success return 0, the value is (*retn)->value[*idx] */
 int btree_search(btree_t *t,  long k,
                  bnode_t **retn,  long *idx);
 
+/*
+ * the key scan inside a node, chosen by cpu feature detection
+ * at the first btree_init, or forced by btree_search_impl.
+ */
+enum btree_search_impl_e {
+    BTREE_SEARCH_AUTO = -1,
+    BTREE_SEARCH_SCALAR,
+    BTREE_SEARCH_SSE42,
+    BTREE_SEARCH_AVX2
+};
+
+/* return the impl in use, it may be lower than asked for */
+int btree_search_impl(int impl);
+
+/*
+ * cursor of B+tree, it streams the records through the leaf chain.
+ * any insert or delete invalidates the cursor.
+ * return 0 when the cursor points to a record, -1 at the end.
+ */
+typedef struct btree_cursor_s {
+    bnode_t *node;
+    int idx;
+} btree_cursor_t;
+
+/* seek to the first record whose key is not less than k */
+int btree_cursor_seek(btree_t *t, btree_cursor_t *c, long k);
+int btree_cursor_first(btree_t *t, btree_cursor_t *c);
+int btree_cursor_last(btree_t *t, btree_cursor_t *c);
+int btree_cursor_next(btree_cursor_t *c);
+int btree_cursor_prev(btree_cursor_t *c);
+int btree_cursor_get(btree_cursor_t *c, long *k, void **v);
+
+/*
+ * copy up to n records from the cursor and move the cursor after them,
+ * values may be NULL. return the number of records copied.
+ */
+int btree_cursor_fetch(btree_cursor_t *c, long *keys, void **values, int n);
+
 /*queue*/
 int btinitqueue(bnode_t *queue);
 int btenqueue(bnode_t *queue, bnode_t *node);
@@ -0,0 +1,272 @@
+#include "htable.h"
+#include "jhash.h"
+#include "builtin.h"
+
+static uint32_t _htable_roundup(uint32_t size)
+{
+    uint32_t n = HTABLE_MIN_SIZE;
+
+    while (n < size && n < (1U << 31)) {
+        n <<= 1;
+    }
+
+    return n;
+}
+
+static int _htable_array_init(htable_array_t *a, uint32_t size)
+{
+    a->bucket = calloc(size, sizeof(struct hlist_head));
+    if (a->bucket == NULL) {
+        return -1;
+    }
+
+    a->size = size;
+    a->mask = size - 1;
+    a->used = 0;
+
+    return 0;
+}
+
+static void _htable_array_reset(htable_array_t *a)
+{
+    a->bucket = NULL;
+    a->size = 0;
+    a->mask = 0;
+    a->used = 0;
+}
+
+htable_t *htable_init(htable_t *t, uint32_t size,
+        htnode_key_func_t key,
+        htnode_cmp_func_t cmp,
+        htnode_del_func_t del)
+{
+    t->min_size = _htable_roundup(size);
+    t->min_load = HTABLE_MIN_LOAD;
+    t->max_load = HTABLE_MAX_LOAD;
+    t->rehashidx = -1;
+
+    t->key = key;
+    t->cmp = cmp;
+    t->del = del;
+
+    _htable_array_reset(&t->ht[1]);
+    if (_htable_array_init(&t->ht[0], t->min_size) != 0) {
+        return NULL;
+    }
+
+    return t;
+}
+
+void htable_destroy(htable_t *t)
+{
+    struct hlist_node *pos, *n;
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < t->ht[i].size; j++) {
+            hlist_for_each_safe(pos, n, &t->ht[i].bucket[j]) {
+                INIT_HLIST_NODE(pos);
+                if (t->del) {
+                    t->del(hlist_entry(pos, htnode_t, hnode));
+                }
+            }
+        }
+
+        free(t->ht[i].bucket);
+        _htable_array_reset(&t->ht[i]);
+    }
+
+    t->rehashidx = -1;
+}
+
+void htable_set_load(htable_t *t, uint32_t min_load, uint32_t max_load)
+{
+    t->min_load = min_load;
+    t->max_load = max_load;
+}
+
+int htable_rehash(htable_t *t, int n)
+{
+    htable_array_t *from = &t->ht[0];
+    htable_array_t *to = &t->ht[1];
+    struct hlist_node *pos, *next;
+    htnode_t *hn;
+    int empty_visits = n * 10;
+
+    if (!htable_is_rehashing(t)) {
+        return 0;
+    }
+
+    while (n-- && from->used != 0) {
+        /* skip empty buckets, but do not loop too long */
+        while (hlist_empty(&from->bucket[t->rehashidx])) {
+            t->rehashidx++;
+            if (--empty_visits == 0) {
+                return 1;
+            }
+        }
+
+        hlist_for_each_safe(pos, next, &from->bucket[t->rehashidx]) {
+            hn = hlist_entry(pos, htnode_t, hnode);
+            __hlist_del(pos);
+            hlist_add_head(pos, &to->bucket[hn->hash & to->mask]);
+            from->used--;
+            to->used++;
+        }
+        t->rehashidx++;
+    }
+
+    if (from->used != 0) {
+        return 1;
+    }
+
+    /* the old array is empty, switch to the new one */
+    free(from->bucket);
+    *from = *to;
+    _htable_array_reset(to);
+    t->rehashidx = -1;
+
+    return 0;
+}
+
+static void _htable_resize(htable_t *t, uint32_t size)
+{
+    if (htable_is_rehashing(t) || size == t->ht[0].size) {
+        return;
+    }
+
+    /* out of memory just keep the old array */
+    if (_htable_array_init(&t->ht[1], size) != 0) {
+        _htable_array_reset(&t->ht[1]);
+        return;
+    }
+
+    t->rehashidx = 0;
+}
+
+static inline void _htable_hash(htable_t *t, htnode_t *n)
+{
+    const void *key;
+    size_t len;
+
+    key = t->key(n, &len);
+    n->hash = 0;
+    n->tag = 0;
+    hashlittle2(key, len, &n->hash, &n->tag);
+}
+
+/* search n in one array, n must be hashed */
+static inline htnode_t *_htable_lookup(htable_t *t, htable_array_t *a,
+        htnode_t *n)
+{
+    struct hlist_node *pos;
+    htnode_t *hn;
+
+    hlist_for_each(pos, &a->bucket[n->hash & a->mask]) {
+        hn = hlist_entry(pos, htnode_t, hnode);
+        if (hn->hash == n->hash && hn->tag == n->tag &&
+                t->cmp(n, hn) == 0) {
+            return hn;
+        }
+    }
+
+    return NULL;
+}
+
+static inline htnode_t *_htable_find(htable_t *t, htnode_t *n)
+{
+    htnode_t *hn;
+
+    /* buckets before rehashidx have been moved to ht[1] */
+    if (!htable_is_rehashing(t) ||
+            (long)(n->hash & t->ht[0].mask) >= t->rehashidx) {
+        hn = _htable_lookup(t, &t->ht[0], n);
+        if (hn) {
+            return hn;
+        }
+    }
+
+    if (htable_is_rehashing(t)) {
+        return _htable_lookup(t, &t->ht[1], n);
+    }
+
+    return NULL;
+}
+
+htnode_t *htable_insert(htable_t *t, htnode_t *n)
+{
+    htable_array_t *a;
+    htnode_t *old;
+
+    if (unlikely(htable_is_rehashing(t))) {
+        htable_rehash(t, HTABLE_REHASH_STEP);
+    }
+
+    _htable_hash(t, n);
+
+    old = _htable_find(t, n);
+    if (old) {
+        return old;
+    }
+
+    a = htable_is_rehashing(t) ? &t->ht[1] : &t->ht[0];
+    hlist_add_head(&n->hnode, &a->bucket[n->hash & a->mask]);
+    a->used++;
+
+    if ((uint64_t)t->ht[0].used * 100 > (uint64_t)t->ht[0].size * t->max_load) {
+        _htable_resize(t, t->ht[0].size << 1);
+    }
+
+    return NULL;
+}
+
+htnode_t *htable_find(htable_t *t, htnode_t *n)
+{
+    if (unlikely(htable_is_rehashing(t))) {
+        htable_rehash(t, HTABLE_REHASH_STEP);
+    }
+
+    _htable_hash(t, n);
+
+    return _htable_find(t, n);
+}
+
+htnode_t *htable_delete(htable_t *t, htnode_t *n)
+{
+    htable_array_t *a;
+    htnode_t *hn;
+
+    if (unlikely(htable_is_rehashing(t))) {
+        htable_rehash(t, HTABLE_REHASH_STEP);
+    }
+
+    _htable_hash(t, n);
+
+    a = &t->ht[0];
+    hn = NULL;
+    if (!htable_is_rehashing(t) ||
+            (long)(n->hash & t->ht[0].mask) >= t->rehashidx) {
+        hn = _htable_lookup(t, a, n);
+    }
+
+    if (hn == NULL && htable_is_rehashing(t)) {
+        a = &t->ht[1];
+        hn = _htable_lookup(t, a, n);
+    }
+
+    if (hn == NULL) {
+        return NULL;
+    }
+
+    hlist_del_init(&hn->hnode);
+    a->used--;
+
+    if (t->min_load != 0 && t->ht[0].size > t->min_size &&
+            (uint64_t)t->ht[0].used * 100 < (uint64_t)t->ht[0].size * t->min_load) {
+        _htable_resize(t, _htable_roundup(t->ht[0].used * 2 > t->min_size ?
+                    t->ht[0].used * 2 : t->min_size));
+    }
+
+    return hn;
+}
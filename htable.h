@@ -0,0 +1,96 @@
+#ifndef HTABLE_H
+#define HTABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "list.h"
+
+/*
+ * intrusive hash table, embed htnode_t into your struct
+ * and get it back with container_of.
+ *
+ * the bucket array is always power of two, and growing or
+ * shrinking is done incrementally: each insert/find/delete
+ * moves HTABLE_REHASH_STEP buckets from the old array to the
+ * new one, so a resize never stalls a single operation.
+ *
+ * the key is hashed once with hashlittle2(), the first value
+ * selects the bucket and the second one is kept as a tag,
+ * the cmp function is only called when both of them match.
+ */
+
+#define HTABLE_MIN_SIZE      16
+#define HTABLE_REHASH_STEP   1
+#define HTABLE_MAX_LOAD      100    /* percent, grow when used > size * 1.0 */
+#define HTABLE_MIN_LOAD      10     /* percent, shrink when used < size * 0.1 */
+
+struct htnode_s;
+struct htable_s;
+
+typedef struct htnode_s htnode_t;
+typedef struct htable_s htable_t;
+
+/* return the key of the node and its length */
+typedef const void *(*htnode_key_func_t)(htnode_t *n, size_t *len);
+/* return 0 when the keys are equal */
+typedef int (*htnode_cmp_func_t)(htnode_t *x, htnode_t *y);
+typedef void (*htnode_del_func_t)(htnode_t *n);
+
+struct htnode_s {
+    struct hlist_node hnode;
+    uint32_t hash;
+    uint32_t tag;
+};
+
+typedef struct htable_array_s {
+    struct hlist_head *bucket;
+    uint32_t size;
+    uint32_t mask;
+    uint32_t used;
+} htable_array_t;
+
+struct htable_s {
+    /* ht[1] is only used while rehashing */
+    htable_array_t ht[2];
+    long rehashidx;
+
+    uint32_t min_size;
+    uint32_t min_load;
+    uint32_t max_load;
+
+    htnode_key_func_t key;
+    htnode_cmp_func_t cmp;
+    htnode_del_func_t del;
+};
+
+#define htable_size(t)          ((t)->ht[0].used + (t)->ht[1].used)
+#define htable_is_rehashing(t)  ((t)->rehashidx != -1)
+
+/*
+ * size is the initial number of buckets, it will be rounded
+ * up to power of two. return NULL when out of memory.
+ */
+htable_t *htable_init(htable_t *t, uint32_t size,
+        htnode_key_func_t key,
+        htnode_cmp_func_t cmp,
+        htnode_del_func_t del);
+void htable_destroy(htable_t *t);
+
+/* load factors in percent, 0 min_load means never shrink */
+void htable_set_load(htable_t *t, uint32_t min_load, uint32_t max_load);
+
+/*
+ * insert the node, if a node with the same key exists
+ * the table is not changed and the old node is returned,
+ * or return NULL.
+ */
+htnode_t *htable_insert(htable_t *t, htnode_t *n);
+
+/* find or delete the node which has the same key with n */
+htnode_t *htable_find(htable_t *t, htnode_t *n);
+htnode_t *htable_delete(htable_t *t, htnode_t *n);
+
+/* move n buckets to the new array, return 0 when rehash done */
+int htable_rehash(htable_t *t, int n);
+
+#endif // HTABLE_H
@@ -171,31 +171,31 @@ int main(int argc, char *argv[])
 void test_btree_splite_child()
 {
     btree_t tree;
-    bnode_t root = {0};
+    bnode_t *root;
     int i;
 
-    for (i = 0; i < BTREE_MAX_KEY; i++) {
-        root.key[i] = i;
+    btree_init(&tree, 4, NULL, NULL);
+    root = btree_node_alloc(&tree, true);
+
+    for (i = 0; i < tree.max_key; i++) {
+        root->key[i] = i;
     }
 
-    root.leaf = true;
-    root.n = BTREE_MAX_KEY;
+    root->n = tree.max_key;
 
-    btree_init(&tree, NULL, NULL);
-    tree.root = &root;
+    tree.root = root;
 
     printf("Init Root:\n");
     btree_bfs(&tree);
 
     printf("-------------------------------------------\n");
-    bnode_t *pnode = calloc(1, sizeof(bnode_t));
+    bnode_t *pnode = btree_node_alloc(&tree, false);
     tree.root = pnode;
 
-    pnode->child[0] = &root;
+    pnode->child[0] = root;
     pnode->n = 0;
-    pnode->leaf = false;
 
-    btree_splite_child(pnode, 0);
+    btree_splite_child(&tree, pnode, 0);
 
     btree_bfs(&tree);
 
@@ -209,7 +209,7 @@ void test_btree_insert()
     int ok;
     int notok;
     int i;
-    btree_init(&tree, NULL, NULL);
+    btree_init(&tree, 0, NULL, NULL);
 
     int max = 50000000;
     int *data;
@@ -221,7 +221,7 @@ void test_btree_insert()
     }
 
     for (i = 0; i < max; i++) {
-        btree_insert(&tree, data[i]);
+        btree_insert(&tree, data[i], NULL);
         ok++;
     }
     printf("-------------------------------------------\n");
@@ -267,7 +267,37 @@ void test_btree_insert()
 }
 
 extern void test_rbt();
+extern void test_htable();
+extern void test_ring();
+extern void test_sync();
+extern void test_avltree();
+extern void test_btree();
+extern void test_bptree();
+extern void test_btree_search();
+extern void test_btree_bulk();
+extern void test_btree_pool();
 int test_skiplist(int argc, char *argv[]);
+extern void test_skiplist_sync();
+extern void test_skiplist_random();
+extern void test_skiplist_rank();
+extern void test_skiplist_arena();
+extern void test_skiplist_key64();
+extern void test_uskiplist();
+extern void test_skiplist_batch();
+extern void test_skiplist_range();
+extern void test_memtable();
+extern void test_rbt_rank();
+extern void test_timer();
+extern void test_rbt_interval();
+extern void test_rbt_build();
+extern void test_avltree_build();
+extern void test_rbt_cursor();
+extern void test_prbt();
+extern void test_timer_check();
+extern void test_skiplist_sync_stress();
+extern void test_prbt_snapshot();
+extern void test_memtable_recover();
+extern void test_avltree_check();
 #include "skiplist.h"
 
 #if 0
@@ -276,6 +306,36 @@ int main(int argc, char *argv[])
     //test_btree_splite_child();
     //test_btree_insert();
     //test_rbt();
+    //test_htable();
+    //test_ring();
+    //test_sync();
+    //test_avltree();
+    //test_btree();
+    //test_bptree();
+    //test_btree_search();
+    //test_btree_bulk();
+    //test_btree_pool();
+    //test_skiplist_sync();
+    //test_skiplist_random();
+    //test_skiplist_rank();
+    //test_skiplist_arena();
+    //test_skiplist_key64();
+    //test_uskiplist();
+    //test_skiplist_batch();
+    //test_skiplist_range();
+    //test_memtable();
+    //test_rbt_rank();
+    //test_timer();
+    //test_rbt_interval();
+    //test_rbt_build();
+    //test_avltree_build();
+    //test_rbt_cursor();
+    //test_prbt();
+    //test_timer_check();
+    //test_skiplist_sync_stress();
+    //test_prbt_snapshot();
+    //test_memtable_recover();
+    //test_avltree_check();
     test_skiplist(argc, argv);
 
     return 0;
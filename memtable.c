@@ -0,0 +1,615 @@
+#include "memtable.h"
+#include "jhash.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MEMTABLE_MAX_LEVEL  20
+#define MEMTABLE_LOG_HEAD   16  /* check, len, key */
+#define MEMTABLE_REC_HEAD   12  /* key, len */
+#define MEMTABLE_CHUNK_HEAD sizeof(void *)
+
+typedef struct memval_s {
+    uint32_t len;
+    char data[0];
+} memval_t;
+
+static int _memtable_write(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static memval_t *_memtable_value_alloc(memtable_t *m, uint32_t len)
+{
+    size_t size = (sizeof(memval_t) + len + 7) & ~(size_t)7;
+    size_t chunk_size = MEMTABLE_VALUE_CHUNK_SIZE;
+    memval_t *v;
+    char *chunk;
+
+    if ((size_t)(m->end - m->cur) < size) {
+        /* a value too big for a chunk gets a chunk of its own */
+        if (size > chunk_size - MEMTABLE_CHUNK_HEAD)
+            chunk_size = size + MEMTABLE_CHUNK_HEAD;
+
+        chunk = malloc(chunk_size);
+        if (chunk == NULL)
+            return NULL;
+
+        *(void **)chunk = m->chunk;
+        m->chunk = chunk;
+        if (chunk_size != MEMTABLE_VALUE_CHUNK_SIZE)
+            return (memval_t *)(chunk + MEMTABLE_CHUNK_HEAD);
+
+        m->cur = chunk + MEMTABLE_CHUNK_HEAD;
+        m->end = chunk + chunk_size;
+    }
+
+    v = (memval_t *)m->cur;
+    m->cur += size;
+
+    return v;
+}
+
+static void _memtable_value_drop(memtable_t *m)
+{
+    void *chunk, *next;
+
+    for (chunk = m->chunk; chunk != NULL; chunk = next) {
+        next = *(void **)chunk;
+        free(chunk);
+    }
+
+    m->chunk = NULL;
+    m->cur = NULL;
+    m->end = NULL;
+    m->bytes = 0;
+}
+
+static int _memtable_insert(memtable_t *m, int64_t key, const void *value,
+        uint32_t len)
+{
+    skiplist_t *sl = &m->list;
+    skipnode_t *n, *old;
+    memval_t *v;
+    int level;
+
+    v = _memtable_value_alloc(m, len);
+    if (v == NULL)
+        return -1;
+    v->len = len;
+    memcpy(v->data, value, len);
+
+    level = sl->random(sl);
+    n = sl->alloc(sl, SKIPNODE_SIZE(level));
+    if (n == NULL)
+        return -1;
+    n->key = key;
+    n->value = v;
+    n->level = level;
+
+    /* the old value stays in its chunk until the flush */
+    old = skiplist_insert(sl, n);
+    if (old != n) {
+        m->bytes -= sizeof(int64_t) + ((memval_t *)old->value)->len;
+        old->value = v;
+        sl->free(sl, n);
+    }
+    m->bytes += sizeof(int64_t) + len;
+
+    return 0;
+}
+
+static int _memtable_log(memtable_t *m, int64_t key, const void *value,
+        uint32_t len)
+{
+    size_t need = m->len + MEMTABLE_LOG_HEAD + len;
+    uint32_t check;
+    char *p;
+
+    /* hashlittle may read the last word of the record whole */
+    if (need + sizeof(uint32_t) > m->cap) {
+        while (need + sizeof(uint32_t) > m->cap)
+            m->cap *= 2;
+        p = realloc(m->buf, m->cap);
+        if (p == NULL)
+            return -1;
+        m->buf = p;
+    }
+
+    p = m->buf + m->len;
+    memcpy(p + 4, &len, 4);
+    memcpy(p + 8, &key, 8);
+    memcpy(p + MEMTABLE_LOG_HEAD, value, len);
+    check = hashlittle(p + 4, MEMTABLE_LOG_HEAD - 4 + len, 0);
+    memcpy(p, &check, 4);
+    m->len = need;
+
+    return 0;
+}
+
+/* called with the lock held, the lock is dropped around the io */
+static void _memtable_group_sync(memtable_t *m)
+{
+    uint64_t target = m->seq;
+    size_t len = m->len;
+    size_t cap = m->cap;
+    char *buf = m->buf;
+    int ret;
+
+    m->buf = m->wbuf;
+    m->cap = m->wcap;
+    m->wbuf = buf;
+    m->wcap = cap;
+    m->len = 0;
+    m->syncing = 1;
+    pthread_mutex_unlock(&m->lock);
+
+    ret = _memtable_write(m->fd, buf, len);
+    if (ret == 0)
+        ret = fdatasync(m->fd);
+
+    pthread_mutex_lock(&m->lock);
+    m->syncing = 0;
+    m->nsync++;
+    if (ret != 0)
+        m->error = -1;
+    else if (m->synced < target)
+        m->synced = target;
+    pthread_cond_broadcast(&m->cond);
+}
+
+static void _memtable_wait_io(memtable_t *m)
+{
+    while (m->syncing)
+        pthread_cond_wait(&m->cond, &m->lock);
+}
+
+/* replay the log, a record that does not check ends it */
+static int _memtable_replay(memtable_t *m)
+{
+    struct stat st;
+    uint32_t check, len;
+    int64_t key;
+    size_t off = 0, got = 0;
+    ssize_t n;
+    char *buf;
+
+    if (fstat(m->fd, &st) != 0)
+        return -1;
+    if (st.st_size == 0)
+        return 0;
+
+    /* a pad word for hashlittle reading the last record */
+    buf = malloc(st.st_size + sizeof(uint32_t));
+    if (buf == NULL)
+        return -1;
+    memset(buf + st.st_size, 0, sizeof(uint32_t));
+
+    while (got < (size_t)st.st_size) {
+        n = pread(m->fd, buf + got, st.st_size - got, got);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+        got += n;
+    }
+
+    while (off + MEMTABLE_LOG_HEAD <= got) {
+        memcpy(&check, buf + off, 4);
+        memcpy(&len, buf + off + 4, 4);
+        memcpy(&key, buf + off + 8, 8);
+        if (len > got - off - MEMTABLE_LOG_HEAD ||
+                hashlittle(buf + off + 4, MEMTABLE_LOG_HEAD - 4 + len, 0) != check)
+            break;
+
+        if (_memtable_insert(m, key, buf + off + MEMTABLE_LOG_HEAD, len) != 0) {
+            free(buf);
+            return -1;
+        }
+        m->seq++;
+        off += MEMTABLE_LOG_HEAD + len;
+    }
+    free(buf);
+
+    m->synced = m->seq;
+    if (off < got && ftruncate(m->fd, off) != 0)
+        return -1;
+
+    return 0;
+}
+
+int memtable_open(memtable_t *m, const char *path, int sync)
+{
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+
+    skiplist_init(&m->list, MEMTABLE_MAX_LEVEL);
+    if (skiplist_arena_init(&m->list) != 0) {
+        skiplist_destroy(&m->list);
+        return -1;
+    }
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    m->sync = sync;
+    m->cap = MEMTABLE_WAL_BUFFER_SIZE;
+    m->wcap = MEMTABLE_WAL_BUFFER_SIZE;
+    m->buf = malloc(m->cap);
+    m->wbuf = malloc(m->wcap);
+
+    m->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (m->buf == NULL || m->wbuf == NULL || m->fd < 0 ||
+            _memtable_replay(m) != 0) {
+        memtable_close(m);
+        return -1;
+    }
+
+    return 0;
+}
+
+void memtable_close(memtable_t *m)
+{
+    pthread_mutex_lock(&m->lock);
+    _memtable_wait_io(m);
+    if (m->fd >= 0) {
+        if (m->len > 0 && m->error == 0 &&
+                _memtable_write(m->fd, m->buf, m->len) == 0 &&
+                m->sync != MEMTABLE_SYNC_NONE)
+            fdatasync(m->fd);
+        close(m->fd);
+        m->fd = -1;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    skiplist_destroy(&m->list);
+    _memtable_value_drop(m);
+    free(m->buf);
+    free(m->wbuf);
+    m->buf = NULL;
+    m->wbuf = NULL;
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+}
+
+int memtable_put(memtable_t *m, int64_t key, const void *value,
+        uint32_t len)
+{
+    uint64_t my;
+    int ret;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->error == 0 &&
+            (_memtable_log(m, key, value, len) != 0 ||
+             _memtable_insert(m, key, value, len) != 0))
+        m->error = -1;
+
+    if (m->error != 0) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+    my = ++m->seq;
+
+    switch (m->sync) {
+    case MEMTABLE_SYNC_NONE:
+        if (m->len >= MEMTABLE_WAL_BUFFER_SIZE) {
+            if (_memtable_write(m->fd, m->buf, m->len) != 0)
+                m->error = -1;
+            m->len = 0;
+        }
+        break;
+
+    case MEMTABLE_SYNC_EACH:
+        if (_memtable_write(m->fd, m->buf, m->len) != 0 ||
+                fdatasync(m->fd) != 0)
+            m->error = -1;
+        m->len = 0;
+        m->synced = my;
+        m->nsync++;
+        break;
+
+    default:
+        /* the first waiter syncs for everyone queued behind it */
+        while (m->synced < my && m->error == 0) {
+            if (m->syncing)
+                pthread_cond_wait(&m->cond, &m->lock);
+            else
+                _memtable_group_sync(m);
+        }
+        break;
+    }
+
+    ret = m->error;
+    pthread_mutex_unlock(&m->lock);
+
+    return ret;
+}
+
+int memtable_get(memtable_t *m, int64_t key, const void **value,
+        uint32_t *len)
+{
+    skipnode_t tmp, *n;
+    memval_t *v;
+
+    tmp.key = key;
+
+    pthread_mutex_lock(&m->lock);
+    n = skiplist_find(&m->list, &tmp);
+    if (n != NULL) {
+        v = n->value;
+        *value = v->data;
+        *len = v->len;
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return n ? 0 : -1;
+}
+
+static int _memtable_flush_file(memtable_t *m, const char *path)
+{
+    skiplist_t *sl = &m->list;
+    skipnode_t *n;
+    memval_t *v;
+    uint64_t off = 0, block = 0;
+    uint64_t footer[4];
+    int64_t *key = NULL, *k;
+    uint64_t *offset = NULL, *o;
+    long nindex = 0, cap = 0, i;
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL)
+        return -1;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    for (n = sl->head->forward[0]; n != sl->null; n = n->forward[0]) {
+        if (nindex == 0 || off - block >= MEMTABLE_BLOCK_SIZE) {
+            if (nindex == cap) {
+                cap = cap ? cap * 2 : 256;
+                k = realloc(key, cap * sizeof(int64_t));
+                o = k ? realloc(offset, cap * sizeof(uint64_t)) : NULL;
+                key = k ? k : key;
+                offset = o ? o : offset;
+                if (k == NULL || o == NULL) {
+                    ret = -1;
+                    break;
+                }
+            }
+            key[nindex] = n->key;
+            offset[nindex] = off;
+            nindex++;
+            block = off;
+        }
+
+        v = n->value;
+        if (fwrite(&n->key, 8, 1, fp) != 1 ||
+                fwrite(&v->len, 4, 1, fp) != 1 ||
+                fwrite(v->data, 1, v->len, fp) != v->len) {
+            ret = -1;
+            break;
+        }
+        off += MEMTABLE_REC_HEAD + v->len;
+    }
+
+    for (i = 0; ret == 0 && i < nindex; i++) {
+        if (fwrite(&key[i], 8, 1, fp) != 1 ||
+                fwrite(&offset[i], 8, 1, fp) != 1)
+            ret = -1;
+    }
+
+    footer[0] = off;
+    footer[1] = nindex;
+    footer[2] = sl->size;
+    footer[3] = MEMTABLE_FILE_MAGIC;
+    if (ret == 0 && (fwrite(footer, sizeof(footer), 1, fp) != 1 ||
+                fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+        ret = -1;
+
+    if (fclose(fp) != 0)
+        ret = -1;
+    free(key);
+    free(offset);
+
+    return ret;
+}
+
+/* make a rename or create in the directory of path durable */
+static int _memtable_sync_dir(const char *path)
+{
+    char dir[4096];
+    const char *slash = strrchr(path, '/');
+    size_t len;
+    int fd, ret;
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        len = slash == path ? 1 : (size_t)(slash - path);
+        if (len >= sizeof(dir))
+            return -1;
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    fd = open(dir, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
+
+int memtable_flush(memtable_t *m, const char *path)
+{
+    char tmp[4096];
+    int ret;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+
+    pthread_mutex_lock(&m->lock);
+    _memtable_wait_io(m);
+
+    /*
+     * the log may only be emptied once the file can not be lost: it is
+     * synced under a temp name, renamed and its directory entry synced.
+     */
+    ret = _memtable_flush_file(m, tmp);
+    if (ret == 0 && rename(tmp, path) != 0)
+        ret = -1;
+    if (ret != 0)
+        unlink(tmp);
+    if (ret == 0 && _memtable_sync_dir(path) != 0)
+        ret = -1;
+    if (ret == 0 && ftruncate(m->fd, 0) != 0)
+        ret = -1;
+
+    if (ret == 0) {
+        /* the records still buffered are durable in the file now */
+        m->len = 0;
+        m->synced = m->seq;
+        skiplist_clear(&m->list);
+        _memtable_value_drop(m);
+        pthread_cond_broadcast(&m->cond);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return ret;
+}
+
+static int _memtable_pread(int fd, void *buf, size_t len, off_t off)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pread(fd, buf, len, off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (char *)buf + n;
+        len -= n;
+        off += n;
+    }
+
+    return 0;
+}
+
+int memtable_file_open(memtable_file_t *f, const char *path)
+{
+    struct stat st;
+    uint64_t footer[4];
+    char *index = NULL;
+    long i;
+
+    memset(f, 0, sizeof(*f));
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0)
+        return -1;
+
+    if (fstat(f->fd, &st) != 0 || st.st_size < (off_t)sizeof(footer) ||
+            _memtable_pread(f->fd, footer, sizeof(footer),
+                st.st_size - sizeof(footer)) != 0 ||
+            footer[3] != MEMTABLE_FILE_MAGIC ||
+            footer[0] + footer[1] * 16 + sizeof(footer) != (uint64_t)st.st_size)
+        goto error;
+
+    f->nindex = footer[1];
+    f->count = footer[2];
+    f->key = malloc((f->nindex + 1) * sizeof(int64_t));
+    f->offset = malloc((f->nindex + 1) * sizeof(uint64_t));
+    index = malloc(f->nindex * 16 + 1);
+    if (f->key == NULL || f->offset == NULL || index == NULL ||
+            _memtable_pread(f->fd, index, f->nindex * 16, footer[0]) != 0)
+        goto error;
+
+    for (i = 0; i < f->nindex; i++) {
+        memcpy(&f->key[i], index + i * 16, 8);
+        memcpy(&f->offset[i], index + i * 16 + 8, 8);
+    }
+    f->offset[f->nindex] = footer[0];
+    free(index);
+
+    return 0;
+
+error:
+    free(index);
+    memtable_file_close(f);
+    return -1;
+}
+
+void memtable_file_close(memtable_file_t *f)
+{
+    if (f->fd >= 0)
+        close(f->fd);
+    free(f->key);
+    free(f->offset);
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+}
+
+long memtable_file_get(memtable_file_t *f, int64_t key, void *value,
+        uint32_t cap)
+{
+    long lo = 0, hi = f->nindex, mid;
+    uint64_t off, size;
+    uint32_t len;
+    int64_t k;
+    char *block, *p;
+    long ret = -1;
+
+    /* the last block whose first key is not greater than key */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (f->key[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return -1;
+
+    off = f->offset[lo - 1];
+    size = f->offset[lo] - off;
+    block = malloc(size);
+    if (block == NULL || _memtable_pread(f->fd, block, size, off) != 0) {
+        free(block);
+        return -1;
+    }
+
+    for (p = block; p + MEMTABLE_REC_HEAD <= block + size;
+            p += MEMTABLE_REC_HEAD + len) {
+        memcpy(&k, p, 8);
+        memcpy(&len, p + 8, 4);
+        if (k > key)
+            break;
+        if (k == key) {
+            memcpy(value, p + MEMTABLE_REC_HEAD, len < cap ? len : cap);
+            ret = len;
+            break;
+        }
+    }
+    free(block);
+
+    return ret;
+}
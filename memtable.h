@@ -0,0 +1,107 @@
+#ifndef MEMTABLE_H
+#define MEMTABLE_H
+
+#include "skiplist.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * write buffer of a key/value store, int64 keys and byte string values.
+ *
+ * a put goes to the write ahead log and to a skiplist whose nodes come
+ * from the skiplist arena, the values are copied into chunks of the
+ * memtable. memtable_flush writes the list out in key order as an
+ * immutable sorted file, renames it into place and syncs its directory,
+ * then empties the memtable and the log.
+ *
+ * the log record is |check|len|key|value|, check is the jhash of the
+ * rest, memtable_open replays the log and cuts a torn tail.
+ */
+#define MEMTABLE_VALUE_CHUNK_SIZE   (1 << 20)
+#define MEMTABLE_WAL_BUFFER_SIZE    (64 * 1024)
+#define MEMTABLE_BLOCK_SIZE         4096
+
+/* sync modes of the log */
+enum memtable_sync_e {
+    MEMTABLE_SYNC_NONE,     /* leave the log to the page cache */
+    MEMTABLE_SYNC_EACH,     /* one fdatasync per put */
+    MEMTABLE_SYNC_GROUP     /* the puts waiting together share one fdatasync */
+};
+
+typedef struct memtable_s {
+    skiplist_t list;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    int fd;
+    int sync;
+    int error;
+
+    /* log records not written yet, the syncing leader owns wbuf */
+    char *buf;
+    size_t len;
+    size_t cap;
+    char *wbuf;
+    size_t wcap;
+    int syncing;
+    uint64_t seq;       /* last record put */
+    uint64_t synced;    /* last record durable */
+    long nsync;         /* fdatasync calls */
+
+    /* values, chunks linked by their first word */
+    char *cur;
+    char *end;
+    void *chunk;
+    size_t bytes;       /* key and value bytes in the table */
+} memtable_t;
+
+/* open or create the log at path and replay it, return 0 or -1 */
+int  memtable_open(memtable_t *m, const char *path, int sync);
+void memtable_close(memtable_t *m);
+
+/*
+ * return 0 when the put is in the table and as durable as the sync
+ * mode asks, -1 on an io or memory error.
+ * the put is visible to memtable_get before it is durable.
+ */
+int  memtable_put(memtable_t *m, int64_t key, const void *value,
+        uint32_t len);
+
+/* the value stays valid until memtable_flush or memtable_close */
+int  memtable_get(memtable_t *m, int64_t key, const void **value,
+        uint32_t *len);
+
+/*
+ * sorted file written by memtable_flush:
+ *
+ *  |record ...|index ...|footer|
+ *
+ * records are |key|len|value| in key order, grouped in blocks of about
+ * MEMTABLE_BLOCK_SIZE bytes. the sparse index holds |key|offset| of the
+ * first record of each block, the footer holds
+ * |index offset|index count|record count|magic|.
+ */
+#define MEMTABLE_FILE_MAGIC 0x4d454d5441424c45ULL
+
+int  memtable_flush(memtable_t *m, const char *path);
+
+typedef struct memtable_file_s {
+    int fd;
+    long count;         /* records */
+    long nindex;
+    int64_t *key;       /* first key of each block */
+    uint64_t *offset;   /* nindex + 1 offsets, the last one is the index */
+} memtable_file_t;
+
+int  memtable_file_open(memtable_file_t *f, const char *path);
+void memtable_file_close(memtable_file_t *f);
+
+/*
+ * copy up to cap bytes of the value of key into value,
+ * return the length of the value or -1 if not found.
+ */
+long memtable_file_get(memtable_file_t *f, int64_t key, void *value,
+        uint32_t cap);
+
+#endif // MEMTABLE_H
@@ -0,0 +1,577 @@
+#include "prbt.h"
+#include <stdlib.h>
+
+#define _prbt_red(n) ((n) != NULL && (n)->color == PRBT_RED)
+
+void prbt_init(prbt_t *t)
+{
+    t->cur.root = NULL;
+    t->cur.size = 0;
+    spin_init(&t->lock);
+    pthread_mutex_init(&t->wlock, NULL);
+    t->gen = 0;
+    atomic_set(&t->nodes, 0);
+}
+
+static inline void _prbt_ref(prbt_node_t *n)
+{
+    if (n)
+        atomic_fetch_and_op(add, &n->ref, 1);
+}
+
+/* drop one reference, free the nodes no one points to any more */
+static void _prbt_unref(prbt_t *t, prbt_node_t *n)
+{
+    prbt_node_t *stack[PRBT_MAX_DEPTH + 2];
+    prbt_node_t *l, *r;
+    int top = 0;
+
+    if (n == NULL || atomic_op_and_fetch(sub, &n->ref, 1) != 0)
+        return;
+
+    stack[top++] = n;
+    while (top) {
+        n = stack[--top];
+        l = n->left;
+        r = n->right;
+        free(n);
+        atomic_fetch_and_op(sub, &t->nodes, 1);
+
+        if (l && atomic_op_and_fetch(sub, &l->ref, 1) == 0)
+            stack[top++] = l;
+        if (r && atomic_op_and_fetch(sub, &r->ref, 1) == 0)
+            stack[top++] = r;
+    }
+}
+
+static prbt_node_t *_prbt_alloc(prbt_t *t)
+{
+    prbt_node_t *n = malloc(sizeof(prbt_node_t));
+
+    if (n) {
+        atomic_set(&n->ref, 1);
+        n->gen = t->gen;
+        atomic_fetch_and_op(add, &t->nodes, 1);
+    }
+
+    return n;
+}
+
+/* a private copy of n for this write, it shares the children of n */
+static prbt_node_t *_prbt_copy(prbt_t *t, prbt_node_t *n)
+{
+    prbt_node_t *c = _prbt_alloc(t);
+
+    if (c) {
+        c->left = n->left;
+        c->right = n->right;
+        c->key = n->key;
+        c->value = n->value;
+        c->color = n->color;
+        _prbt_ref(c->left);
+        _prbt_ref(c->right);
+    }
+
+    return c;
+}
+
+/*
+ * make the node at link private to this write before changing it,
+ * link is a child pointer of a private node or the new root.
+ */
+static prbt_node_t *_prbt_own(prbt_t *t, prbt_node_t **link)
+{
+    prbt_node_t *n = *link;
+    prbt_node_t *c;
+
+    if (n->gen == t->gen)
+        return n;
+
+    c = _prbt_copy(t, n);
+    if (c) {
+        *link = c;
+        _prbt_unref(t, n);
+    }
+
+    return c;
+}
+
+/*
+ * rotations only move the edges between private nodes, every node
+ * keeps the same number of parents so no count changes. gp is the
+ * parent of x, NULL at the root.
+ */
+static void _prbt_replace(prbt_node_t **root, prbt_node_t *gp,
+        prbt_node_t *x, prbt_node_t *y)
+{
+    if (gp == NULL)
+        *root = y;
+    else if (gp->left == x)
+        gp->left = y;
+    else
+        gp->right = y;
+}
+
+static void _prbt_left_rotate(prbt_node_t **root, prbt_node_t *gp,
+        prbt_node_t *x)
+{
+    prbt_node_t *y = x->right;
+
+    x->right = y->left;
+    y->left = x;
+    _prbt_replace(root, gp, x, y);
+}
+
+static void _prbt_right_rotate(prbt_node_t **root, prbt_node_t *gp,
+        prbt_node_t *x)
+{
+    prbt_node_t *y = x->left;
+
+    x->left = y->right;
+    y->right = x;
+    _prbt_replace(root, gp, x, y);
+}
+
+/* start a write on a private copy of the newest root */
+static prbt_node_t *_prbt_begin(prbt_t *t)
+{
+    t->gen++;
+
+    if (t->cur.root == NULL)
+        return NULL;
+
+    return _prbt_copy(t, t->cur.root);
+}
+
+/* publish root as the newest version and drop the old one */
+static void _prbt_commit(prbt_t *t, prbt_node_t *root, unsigned long size)
+{
+    prbt_node_t *old;
+
+    spin_lock(&t->lock);
+    old = t->cur.root;
+    t->cur.root = root;
+    t->cur.size = size;
+    spin_unlock(&t->lock);
+
+    pthread_mutex_unlock(&t->wlock);
+
+    _prbt_unref(t, old);
+}
+
+static void _prbt_abort(prbt_t *t, prbt_node_t *root)
+{
+    pthread_mutex_unlock(&t->wlock);
+    _prbt_unref(t, root);
+}
+
+int prbt_insert(prbt_t *t, long key, void *value)
+{
+    prbt_node_t *path[PRBT_MAX_DEPTH + 1];
+    prbt_node_t *root, *x, *p, *g, *u, *c;
+    prbt_node_t **link;
+    int d = 0;
+
+    pthread_mutex_lock(&t->wlock);
+
+    root = _prbt_begin(t);
+    if (t->cur.root != NULL && root == NULL) {
+        pthread_mutex_unlock(&t->wlock);
+        return -1;
+    }
+
+    /* copy the path down to the parent of the new node */
+    link = &root;
+    while (*link != NULL) {
+        x = _prbt_own(t, link);
+        if (x == NULL)
+            goto failed;
+
+        if (key == x->key) {
+            x->value = value;
+            _prbt_commit(t, root, t->cur.size);
+            return 1;
+        }
+
+        path[d++] = x;
+        link = key < x->key ? &x->left : &x->right;
+    }
+
+    x = _prbt_alloc(t);
+    if (x == NULL)
+        goto failed;
+
+    x->left = NULL;
+    x->right = NULL;
+    x->key = key;
+    x->value = value;
+    x->color = PRBT_RED;
+    *link = x;
+
+    /* the parent and grandparent are on the path, only the uncle is shared */
+    while (d >= 2 && _prbt_red(path[d - 1])) {
+        p = path[d - 1];
+        g = path[d - 2];
+
+        if (p == g->left) {
+            if (_prbt_red(g->right)) {
+                u = _prbt_own(t, &g->right);
+                if (u == NULL)
+                    goto failed;
+                p->color = PRBT_BLACK;
+                u->color = PRBT_BLACK;
+                g->color = PRBT_RED;
+                x = g;
+                d -= 2;
+                continue;
+            }
+
+            if (x == p->right) {
+                _prbt_left_rotate(&root, g, p);
+                c = x;
+                x = p;
+                p = c;
+            }
+            p->color = PRBT_BLACK;
+            g->color = PRBT_RED;
+            _prbt_right_rotate(&root, d >= 3 ? path[d - 3] : NULL, g);
+
+        } else {
+            if (_prbt_red(g->left)) {
+                u = _prbt_own(t, &g->left);
+                if (u == NULL)
+                    goto failed;
+                p->color = PRBT_BLACK;
+                u->color = PRBT_BLACK;
+                g->color = PRBT_RED;
+                x = g;
+                d -= 2;
+                continue;
+            }
+
+            if (x == p->left) {
+                _prbt_right_rotate(&root, g, p);
+                c = x;
+                x = p;
+                p = c;
+            }
+            p->color = PRBT_BLACK;
+            g->color = PRBT_RED;
+            _prbt_left_rotate(&root, d >= 3 ? path[d - 3] : NULL, g);
+        }
+        break;
+    }
+
+    root->color = PRBT_BLACK;
+    _prbt_commit(t, root, t->cur.size + 1);
+
+    return 0;
+
+failed:
+    _prbt_abort(t, root);
+    return -1;
+}
+
+int prbt_delete(prbt_t *t, long key)
+{
+    prbt_node_t *path[PRBT_MAX_DEPTH + 2];
+    prbt_node_t *root, *x, *y, *z, *p, *gp, *w, *c;
+    prbt_node_t *dead = NULL;
+    prbt_node_t **link;
+    prbt_snap_t s;
+    int d = 0, left;
+
+    pthread_mutex_lock(&t->wlock);
+
+    /* the newest version can not change under wlock */
+    s = t->cur;
+    if (prbt_find(&s, key) == NULL) {
+        pthread_mutex_unlock(&t->wlock);
+        return -1;
+    }
+
+    root = _prbt_begin(t);
+    if (root == NULL) {
+        pthread_mutex_unlock(&t->wlock);
+        return -1;
+    }
+
+    link = &root;
+    for ( ;; ) {
+        z = _prbt_own(t, link);
+        if (z == NULL)
+            goto failed;
+
+        path[d++] = z;
+        if (key == z->key)
+            break;
+        link = key < z->key ? &z->left : &z->right;
+    }
+
+    /* a node with two children takes the key of its successor */
+    y = z;
+    if (z->left != NULL && z->right != NULL) {
+        link = &z->right;
+        do {
+            y = _prbt_own(t, link);
+            if (y == NULL)
+                goto failed;
+            path[d++] = y;
+            link = &y->left;
+        } while (y->left != NULL);
+
+        z->key = y->key;
+        z->value = y->value;
+    }
+
+    /* y has one child at most, the parent of y takes it over */
+    x = y->left != NULL ? y->left : y->right;
+    d--;
+    p = d ? path[d - 1] : NULL;
+    left = p != NULL && p->left == y;
+    _prbt_replace(&root, p, y, x);
+    dead = y;
+
+    if (y->color == PRBT_BLACK) {
+        while (d > 0 && !_prbt_red(x)) {
+            p = path[d - 1];
+            gp = d >= 2 ? path[d - 2] : NULL;
+
+            if (left) {
+                w = _prbt_own(t, &p->right);
+                if (w == NULL)
+                    goto failed;
+
+                if (w->color == PRBT_RED) {
+                    w->color = PRBT_BLACK;
+                    p->color = PRBT_RED;
+                    _prbt_left_rotate(&root, gp, p);
+                    path[d - 1] = w;
+                    path[d++] = p;
+                    gp = w;
+                    w = _prbt_own(t, &p->right);
+                    if (w == NULL)
+                        goto failed;
+                }
+
+                if (!_prbt_red(w->left) && !_prbt_red(w->right)) {
+                    w->color = PRBT_RED;
+                    x = p;
+                    d--;
+                    left = gp != NULL && gp->left == x;
+                    continue;
+                }
+
+                if (!_prbt_red(w->right)) {
+                    c = _prbt_own(t, &w->left);
+                    if (c == NULL)
+                        goto failed;
+                    c->color = PRBT_BLACK;
+                    w->color = PRBT_RED;
+                    _prbt_right_rotate(&root, p, w);
+                    w = c;
+                }
+
+                c = _prbt_own(t, &w->right);
+                if (c == NULL)
+                    goto failed;
+                w->color = p->color;
+                p->color = PRBT_BLACK;
+                c->color = PRBT_BLACK;
+                _prbt_left_rotate(&root, gp, p);
+
+            } else {
+                w = _prbt_own(t, &p->left);
+                if (w == NULL)
+                    goto failed;
+
+                if (w->color == PRBT_RED) {
+                    w->color = PRBT_BLACK;
+                    p->color = PRBT_RED;
+                    _prbt_right_rotate(&root, gp, p);
+                    path[d - 1] = w;
+                    path[d++] = p;
+                    gp = w;
+                    w = _prbt_own(t, &p->left);
+                    if (w == NULL)
+                        goto failed;
+                }
+
+                if (!_prbt_red(w->left) && !_prbt_red(w->right)) {
+                    w->color = PRBT_RED;
+                    x = p;
+                    d--;
+                    left = gp != NULL && gp->left == x;
+                    continue;
+                }
+
+                if (!_prbt_red(w->left)) {
+                    c = _prbt_own(t, &w->right);
+                    if (c == NULL)
+                        goto failed;
+                    c->color = PRBT_BLACK;
+                    w->color = PRBT_RED;
+                    _prbt_left_rotate(&root, p, w);
+                    w = c;
+                }
+
+                c = _prbt_own(t, &w->left);
+                if (c == NULL)
+                    goto failed;
+                w->color = p->color;
+                p->color = PRBT_BLACK;
+                c->color = PRBT_BLACK;
+                _prbt_right_rotate(&root, gp, p);
+            }
+
+            x = NULL;
+            break;
+        }
+
+        /* a red x absorbs the missing black, it may still be shared */
+        if (_prbt_red(x)) {
+            link = d ? (left ? &path[d - 1]->left : &path[d - 1]->right)
+                : &root;
+            x = _prbt_own(t, link);
+            if (x == NULL)
+                goto failed;
+            x->color = PRBT_BLACK;
+        }
+    }
+
+    if (_prbt_red(root)) {
+        x = _prbt_own(t, &root);
+        if (x == NULL)
+            goto failed;
+        x->color = PRBT_BLACK;
+    }
+
+    /* the reference of y to x went to the parent of y */
+    free(dead);
+    atomic_fetch_and_op(sub, &t->nodes, 1);
+
+    _prbt_commit(t, root, t->cur.size - 1);
+
+    return 0;
+
+failed:
+    if (dead != NULL) {
+        /* dead is unlinked but still private, free it with the root */
+        dead->left = root;
+        dead->right = NULL;
+        root = dead;
+    }
+    _prbt_abort(t, root);
+    return -1;
+}
+
+void prbt_snapshot(prbt_t *t, prbt_snap_t *s)
+{
+    spin_lock(&t->lock);
+    *s = t->cur;
+    _prbt_ref(s->root);
+    spin_unlock(&t->lock);
+}
+
+void prbt_release(prbt_t *t, prbt_snap_t *s)
+{
+    _prbt_unref(t, s->root);
+    s->root = NULL;
+    s->size = 0;
+}
+
+void prbt_destroy(prbt_t *t)
+{
+    pthread_mutex_lock(&t->wlock);
+    _prbt_commit(t, NULL, 0);
+    pthread_mutex_destroy(&t->wlock);
+}
+
+prbt_node_t *prbt_find(prbt_snap_t *s, long key)
+{
+    prbt_node_t *x = s->root;
+
+    while (x != NULL && x->key != key)
+        x = key < x->key ? x->left : x->right;
+
+    return x;
+}
+
+long prbt_range(prbt_snap_t *s, long lo, long hi,
+        prbt_func_t func, void *arg)
+{
+    prbt_node_t *stack[PRBT_MAX_DEPTH];
+    prbt_node_t *x = s->root;
+    long count = 0;
+    int top = 0;
+
+    for ( ;; ) {
+        /* push the nodes not less than lo down the left edge */
+        while (x != NULL) {
+            if (x->key < lo) {
+                x = x->right;
+            } else {
+                stack[top++] = x;
+                x = x->left;
+            }
+        }
+
+        if (top == 0)
+            break;
+
+        x = stack[--top];
+        if (x->key > hi)
+            break;
+
+        count++;
+        if (func && func(x, arg))
+            break;
+
+        x = x->right;
+    }
+
+    return count;
+}
+
+/* the black height of n, -1 if not valid */
+static int _prbt_check(prbt_node_t *n, long *lo, long *hi, unsigned long *size)
+{
+    int l, r;
+
+    if (n == NULL)
+        return 1;
+
+    if (atomic_read(&n->ref) < 1)
+        return -1;
+
+    if ((lo && n->key <= *lo) || (hi && n->key >= *hi))
+        return -1;
+
+    if (n->color == PRBT_RED && (_prbt_red(n->left) || _prbt_red(n->right)))
+        return -1;
+
+    l = _prbt_check(n->left, lo, &n->key, size);
+    r = _prbt_check(n->right, &n->key, hi, size);
+    if (l < 0 || r < 0 || l != r)
+        return -1;
+
+    (*size)++;
+
+    return l + (n->color == PRBT_BLACK);
+}
+
+int prbt_check(prbt_snap_t *s)
+{
+    unsigned long size = 0;
+
+    if (_prbt_red(s->root))
+        return 2;
+
+    if (_prbt_check(s->root, NULL, NULL, &size) < 0)
+        return 1;
+
+    if (size != s->size)
+        return 3;
+
+    return 0;
+}
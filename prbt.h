@@ -0,0 +1,87 @@
+#ifndef __PRBT_H__
+#define __PRBT_H__
+
+#include "sync.h"
+#include <pthread.h>
+
+/*
+ * persistent red black tree by path copying.
+ *
+ * a write copies the O(log n) nodes on its path, the untouched
+ * subtrees are shared with the older versions. a version is only
+ * its root, every node counts the parents and versions pointing to
+ * it, so releasing the last snapshot of a version frees the nodes no
+ * newer version shares.
+ *
+ * writers are serialized by wlock, readers take a snapshot under a
+ * short spinlock and then read it without any lock while the writers
+ * go on. the values are not freed by the tree, they may be shared by
+ * the copies of a node.
+ */
+#define PRBT_MAX_DEPTH  128     /* 2 * log2 of the largest tree */
+
+enum prbt_color_e {
+    PRBT_RED,
+    PRBT_BLACK
+};
+
+typedef struct prbt_node_s prbt_node_t;
+
+struct prbt_node_s {
+    prbt_node_t *left;
+    prbt_node_t *right;
+    long key;
+    void *value;
+    atomic_t ref;           /* parents and snapshots */
+    int color;
+    unsigned long gen;      /* write that made the node */
+};
+
+typedef struct prbt_snap_s {
+    prbt_node_t *root;
+    unsigned long size;
+} prbt_snap_t;
+
+typedef struct prbt_s {
+    prbt_snap_t cur;        /* the newest version, guarded by lock */
+    spinlock_t lock;
+    pthread_mutex_t wlock;
+    unsigned long gen;
+    atomic_t nodes;         /* nodes alive in all versions */
+} prbt_t;
+
+/* return non zero to stop prbt_range */
+typedef int (*prbt_func_t)(prbt_node_t *n, void *arg);
+
+void prbt_init(prbt_t *t);
+
+/* drop the newest version, the snapshots still held stay readable */
+void prbt_destroy(prbt_t *t);
+
+/*
+ * make a new version with key set to value, or without key.
+ * prbt_insert return 0 if key is new, 1 if its value is replaced.
+ * prbt_delete return 0, or -1 if key is not found.
+ * both return -1 if out of memory, the newest version is unchanged.
+ */
+int prbt_insert(prbt_t *t, long key, void *value);
+int prbt_delete(prbt_t *t, long key);
+
+/* pin the newest version, O(1), it must be released */
+void prbt_snapshot(prbt_t *t, prbt_snap_t *s);
+void prbt_release(prbt_t *t, prbt_snap_t *s);
+
+/* lock free reads of a snapshot */
+prbt_node_t *prbt_find(prbt_snap_t *s, long key);
+
+/*
+ * call func on the nodes with lo <= key <= hi in key order, func
+ * may be NULL to only count. return the number of nodes visited.
+ */
+long prbt_range(prbt_snap_t *s, long lo, long hi,
+        prbt_func_t func, void *arg);
+
+/* 0 if the snapshot is a red black tree of size nodes */
+int prbt_check(prbt_snap_t *s);
+
+#endif /* __PRBT_H__ */
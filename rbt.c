@@ -1,10 +1,29 @@
 #include "rbt.h"
+#include <limits.h>
+#include <assert.h>
 
 int rbt_cmp_func(rbt_node_t *x, rbt_node_t *y)
 {
     return x->key - y->key;
 }
 
+static int _rbt_interval_cmp(rbt_node_t *x, rbt_node_t *y)
+{
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+static inline void _rbt_interval_update(rbt_node_t *n)
+{
+    long max = n->end;
+
+    if (n->left->max > max)
+        max = n->left->max;
+    if (n->right->max > max)
+        max = n->right->max;
+
+    n->max = max;
+}
+
 
 void rbt_init(rbt_tree_t *t, 
         rbt_cmp_func_t cmp,
@@ -20,8 +39,11 @@ void rbt_init(rbt_tree_t *t,
     t->nil->p = t->nil;
     t->nil->left = t->nil;
     t->nil->right = t->nil;
+    t->nil->size = 0;
+    t->nil->max = LONG_MIN;
 
     t->size = 0;
+    t->interval = 0;
 
     t->cmp = cmp;
     t->free = free;
@@ -29,31 +51,62 @@ void rbt_init(rbt_tree_t *t,
     t->bfs = bfs;
 }
 
+void rbt_interval_init(rbt_tree_t *t, rbt_free_func_t free)
+{
+    rbt_init(t, _rbt_interval_cmp, free, NULL, NULL);
+    t->interval = 1;
+}
+
 void rbt_clear(rbt_tree_t *t, rbt_node_t *r)
 {
-   if (r == t->nil)
-       return ;
+    rbt_node_t *x = r;
+    rbt_node_t *p;
 
-   rbt_clear(t, r->left);
-   rbt_clear(t, r->right);
+    assert(r == t->root);
+    if (r == t->nil)
+        return;
 
-   if (r->p == t->nil)
-       t->root = t->nil;
-   else if (r->p->left == r)
-       r->p->left = t->nil;
-   else
-       r->p->right = t->nil;
+    /* go down to a leaf, free it and go back to its parent */
+    for ( ;; ) {
+        if (x->left != t->nil) {
+            x = x->left;
+            continue;
+        }
+
+        if (x->right != t->nil) {
+            x = x->right;
+            continue;
+        }
+
+        p = x->p;
+        if (p == t->nil)
+            t->root = t->nil;
+        else if (p->left == x)
+            p->left = t->nil;
+        else
+            p->right = t->nil;
 
-   if (t->free)
-       t->free(r);
+        t->size--;
 
-   t->size--;
+        if (x == r) {
+            if (t->free)
+                t->free(x);
+            break;
+        }
+
+        if (t->free)
+            t->free(x);
+        x = p;
+    }
 }
 
 void rbt_destroy(rbt_tree_t *t)
 {
+    int interval = t->interval;
+
     rbt_clear(t, t->root);
     rbt_init(t, t->cmp, t->free, t->travel, t->bfs);
+    t->interval = interval;
 }
 
 void rbt_left_rotate(rbt_tree_t *t, rbt_node_t *n)
@@ -83,6 +136,14 @@ void rbt_left_rotate(rbt_tree_t *t, rbt_node_t *n)
 
     x->left = n;
     n->p = x;
+
+    x->size = n->size;
+    n->size = n->left->size + n->right->size + 1;
+
+    if (t->interval) {
+        _rbt_interval_update(n);
+        _rbt_interval_update(x);
+    }
 }
 
 void rbt_right_rotate(rbt_tree_t *t, rbt_node_t *n)
@@ -104,6 +165,14 @@ void rbt_right_rotate(rbt_tree_t *t, rbt_node_t *n)
 
     x->right = n;
     n->p = x;
+
+    x->size = n->size;
+    n->size = n->left->size + n->right->size + 1;
+
+    if (t->interval) {
+        _rbt_interval_update(n);
+        _rbt_interval_update(x);
+    }
 }
 
 rbt_node_t *rbt_min(rbt_tree_t *t, rbt_node_t *min)
@@ -157,6 +226,220 @@ rbt_node_t *rbt_next(rbt_tree_t *t, rbt_node_t *n)
     return next;
 }
 
+rbt_node_t *rbt_prev(rbt_tree_t *t, rbt_node_t *n)
+{
+    rbt_node_t *prev;
+
+    if (n->left != t->nil) {
+        prev = rbt_max(t, n->left);
+    } else {
+        prev = n->p;
+        while (prev != t->nil && prev->left == n) {
+            n = prev;
+            prev = prev->p;
+        }
+    }
+
+    return prev;
+}
+
+rbt_node_t *rbt_lower_bound(rbt_tree_t *t, rbt_node_t *n)
+{
+    rbt_node_t *x = t->root;
+    rbt_node_t *y = t->nil;
+
+    while (x != t->nil) {
+        if (t->cmp(x, n) >= 0) {
+            y = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+
+    return y;
+}
+
+rbt_node_t *rbt_upper_bound(rbt_tree_t *t, rbt_node_t *n)
+{
+    rbt_node_t *x = t->root;
+    rbt_node_t *y = t->nil;
+
+    while (x != t->nil) {
+        if (t->cmp(x, n) > 0) {
+            y = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+
+    return y;
+}
+
+void rbt_cursor_init(rbt_tree_t *t, rbt_cursor_t *c)
+{
+    c->t = t;
+    c->node = t->nil;
+}
+
+rbt_node_t *rbt_cursor_first(rbt_cursor_t *c)
+{
+    c->node = rbt_min(c->t, c->t->root);
+    return c->node;
+}
+
+rbt_node_t *rbt_cursor_last(rbt_cursor_t *c)
+{
+    c->node = rbt_max(c->t, c->t->root);
+    return c->node;
+}
+
+rbt_node_t *rbt_cursor_lower(rbt_cursor_t *c, rbt_node_t *n)
+{
+    c->node = rbt_lower_bound(c->t, n);
+    return c->node;
+}
+
+rbt_node_t *rbt_cursor_upper(rbt_cursor_t *c, rbt_node_t *n)
+{
+    c->node = rbt_upper_bound(c->t, n);
+    return c->node;
+}
+
+rbt_node_t *rbt_cursor_next(rbt_cursor_t *c)
+{
+    if (c->node != c->t->nil)
+        c->node = rbt_next(c->t, c->node);
+
+    return c->node;
+}
+
+rbt_node_t *rbt_cursor_prev(rbt_cursor_t *c)
+{
+    if (c->node == c->t->nil)
+        c->node = rbt_max(c->t, c->t->root);
+    else
+        c->node = rbt_prev(c->t, c->node);
+
+    return c->node;
+}
+
+rbt_node_t *rbt_select(rbt_tree_t *t, unsigned long i)
+{
+    rbt_node_t *x = t->root;
+
+    while (x != t->nil) {
+        if (i < x->left->size) {
+            x = x->left;
+        } else if (i == x->left->size) {
+            break;
+        } else {
+            i -= x->left->size + 1;
+            x = x->right;
+        }
+    }
+
+    return x;
+}
+
+unsigned long rbt_rank(rbt_tree_t *t, rbt_node_t *n)
+{
+    unsigned long rank = n->left->size;
+
+    for (; n->p != t->nil; n = n->p) {
+        if (n == n->p->right)
+            rank += n->p->left->size + 1;
+    }
+
+    return rank;
+}
+
+/* the nodes less than k, or not greater than k when equal is set */
+static unsigned long _rbt_count_before(rbt_tree_t *t, rbt_node_t *k,
+        int equal)
+{
+    rbt_node_t *x = t->root;
+    unsigned long count = 0;
+    int v;
+
+    while (x != t->nil) {
+        v = t->cmp(x, k);
+        if (v < 0 || (equal && v == 0)) {
+            count += x->left->size + 1;
+            x = x->right;
+        } else {
+            x = x->left;
+        }
+    }
+
+    return count;
+}
+
+unsigned long rbt_count_range(rbt_tree_t *t, rbt_node_t *lo, rbt_node_t *hi)
+{
+    unsigned long l, h;
+
+    l = _rbt_count_before(t, lo, 0);
+    h = _rbt_count_before(t, hi, 1);
+
+    return h > l ? h - l : 0;
+}
+
+static long _rbt_overlap(rbt_tree_t *t, rbt_node_t *x, long lo, long hi,
+        rbt_interval_func_t func, void *arg, int *stop)
+{
+    long count;
+
+    /* nothing in this subtree ends after lo */
+    if (x == t->nil || x->max <= lo)
+        return 0;
+
+    count = _rbt_overlap(t, x->left, lo, hi, func, arg, stop);
+
+    /* the right subtree starts at or after hi */
+    if (*stop || x->key >= hi)
+        return count;
+
+    if (x->end > lo) {
+        count++;
+        if (func && func(x, arg)) {
+            *stop = 1;
+            return count;
+        }
+    }
+
+    return count + _rbt_overlap(t, x->right, lo, hi, func, arg, stop);
+}
+
+long rbt_overlap(rbt_tree_t *t, long lo, long hi,
+        rbt_interval_func_t func, void *arg)
+{
+    int stop = 0;
+
+    return _rbt_overlap(t, t->root, lo, hi, func, arg, &stop);
+}
+
+long rbt_stab(rbt_tree_t *t, long point,
+        rbt_interval_func_t func, void *arg)
+{
+    return rbt_overlap(t, point, point + 1, func, arg);
+}
+
+rbt_node_t *rbt_overlap_any(rbt_tree_t *t, long lo, long hi)
+{
+    rbt_node_t *x = t->root;
+
+    while (x != t->nil && !(x->key < hi && x->end > lo)) {
+        if (x->left->max > lo)
+            x = x->left;
+        else
+            x = x->right;
+    }
+
+    return x;
+}
+
 void rbt_transplant(rbt_tree_t *t, rbt_node_t *x, rbt_node_t *y)
 {
     y->p = x->p;
@@ -223,7 +506,11 @@ rbt_node_t *rbt_insert(rbt_tree_t *t, rbt_node_t *n)
     rbt_node_t *x = t->root;
     char left = 0;
 
+    /* every node on the path gets n in its subtree */
     while (x != t->nil) {
+        x->size++;
+        if (t->interval && n->end > x->max)
+            x->max = n->end;
         p = x;
         left = 0;
         if (t->cmp(n, x) <= 0) {
@@ -244,6 +531,8 @@ rbt_node_t *rbt_insert(rbt_tree_t *t, rbt_node_t *n)
 
     n->left = t->nil;
     n->right = t->nil;
+    n->size = 1;
+    n->max = n->end;
 
     n->color = RBT_RED;
 
@@ -254,6 +543,52 @@ rbt_node_t *rbt_insert(rbt_tree_t *t, rbt_node_t *n)
     return n;
 }
 
+static rbt_node_t *_rbt_build(rbt_tree_t *t, rbt_node_t **nodes,
+        unsigned long n, rbt_node_t *p, int depth, int red)
+{
+    rbt_node_t *x;
+    unsigned long mid;
+
+    if (n == 0)
+        return t->nil;
+
+    mid = n / 2;
+    x = nodes[mid];
+    x->p = p;
+    x->color = depth == red ? RBT_RED : RBT_BLACK;
+    x->size = n;
+    x->left = _rbt_build(t, nodes, mid, x, depth + 1, red);
+    x->right = _rbt_build(t, nodes + mid + 1, n - mid - 1, x, depth + 1, red);
+
+    if (t->interval)
+        _rbt_interval_update(x);
+
+    return x;
+}
+
+int rbt_build_sorted(rbt_tree_t *t, rbt_node_t **nodes, unsigned long n)
+{
+    int red;
+
+    if (t->root != t->nil)
+        return -1;
+
+    if (n == 0)
+        return 0;
+
+    /*
+     * the halves differ by one node at most, so every leaf is at the
+     * last level or the one above, painting the last level red gives
+     * every path the same black height.
+     */
+    red = 63 - __builtin_clzl(n);
+    t->root = _rbt_build(t, nodes, n, t->nil, 0, red);
+    t->root->color = RBT_BLACK;
+    t->size = n;
+
+    return 0;
+}
+
 rbt_node_t *rbt_delete_fixup(rbt_tree_t *t, rbt_node_t *n)
 {
     rbt_node_t *p;
@@ -318,6 +653,11 @@ rbt_node_t *rbt_delete(rbt_tree_t *t, rbt_node_t *z)
     y = z;
     yc = y->color;
 
+    /* the node leaving its place is z or its successor */
+    x = z->left == t->nil || z->right == t->nil ? z : rbt_min(t, z->right);
+    for (x = x->p; x != t->nil; x = x->p)
+        x->size--;
+
     if (y->left == t->nil) {
         x = y->right;
         rbt_transplant(t, y, x);
@@ -340,6 +680,13 @@ rbt_node_t *rbt_delete(rbt_tree_t *t, rbt_node_t *z)
         y->right->p = y;
 
         y->color = z->color;
+        y->size = z->size;
+    }
+
+    /* x->p is the lowest node whose subtree lost z */
+    if (t->interval) {
+        for (y = x->p; y != t->nil; y = y->p)
+            _rbt_interval_update(y);
     }
 
     if (yc == RBT_BLACK)
@@ -350,41 +697,81 @@ rbt_node_t *rbt_delete(rbt_tree_t *t, rbt_node_t *z)
 
 void rbt_preorder(rbt_tree_t *t, rbt_node_t *r)
 {
-    if (r == t->nil)
-        return;
+    rbt_node_t *x = r;
 
-    if (t->travel) {
-        t->travel(t, NULL, r);
+    while (x != t->nil) {
+        if (t->travel) {
+            t->travel(t, NULL, x);
+        }
+
+        if (x->left != t->nil) {
+            x = x->left;
+        } else if (x->right != t->nil) {
+            x = x->right;
+        } else {
+            /* up to the first left child whose parent has a right child */
+            while (x != r && (x->p->right == x || x->p->right == t->nil))
+                x = x->p;
+            x = x == r ? t->nil : x->p->right;
+        }
     }
-    rbt_preorder(t, r->left);
-    rbt_preorder(t, r->right);
 }
 
 void rbt_inorder(rbt_tree_t *t, rbt_node_t *r)
 {
-    if (r == t->nil)
-        return;
+    rbt_node_t *x = rbt_min(t, r);
+
+    while (x != t->nil) {
+        if (t->travel) {
+            t->travel(t, NULL, x);
+        }
 
-    rbt_inorder(t, r->left);
-    if (t->travel) {
-        t->travel(t, NULL, r);
+        if (x->right != t->nil) {
+            x = rbt_min(t, x->right);
+        } else {
+            while (x != r && x->p->right == x)
+                x = x->p;
+            x = x == r ? t->nil : x->p;
+        }
+    }
+}
+
+/* the first node of r in post order */
+static rbt_node_t *_rbt_post_first(rbt_tree_t *t, rbt_node_t *x)
+{
+    for ( ;; ) {
+        if (x->left != t->nil)
+            x = x->left;
+        else if (x->right != t->nil)
+            x = x->right;
+        else
+            return x;
     }
-    rbt_inorder(t, r->right);
 }
 
 void rbt_postorder(rbt_tree_t *t, rbt_node_t *r)
 {
+    rbt_node_t *x;
+
     if (r == t->nil)
         return;
 
-    rbt_postorder(t, r->left);
-    rbt_postorder(t, r->right);
-    if (t->travel) {
-        t->travel(t, NULL, r);
+    x = _rbt_post_first(t, r);
+    for ( ;; ) {
+        if (t->travel) {
+            t->travel(t, NULL, x);
+        }
+
+        if (x == r)
+            break;
+
+        if (x->p->left == x && x->p->right != t->nil)
+            x = _rbt_post_first(t, x->p->right);
+        else
+            x = x->p;
     }
 }
 
-
 void rbt_queue_init(rbt_node_t *queue)
 {
     queue->next = queue;
@@ -464,12 +851,15 @@ void rbt_bfs(rbt_tree_t *t)
  *     3 -> nil  is not black
  *     4 -> red node own red child
  *     5 -> path's black nodes is not same
+ *     6 -> subtree size is wrong
+ *     7 -> interval max is wrong
  * */
 int rbt_check(rbt_tree_t *t)
 {
     rbt_node_t queue;
     rbt_node_t *n, *p;
     rbt_node_t endsq;
+    long max;
 
     if (t->root->color != RBT_BLACK) {
         return 2;
@@ -493,6 +883,18 @@ int rbt_check(rbt_tree_t *t)
             return 1;
         }
 
+        if (n->size != n->left->size + n->right->size + 1) {
+            return 6;
+        }
+
+        if (t->interval) {
+            max = n->max;
+            _rbt_interval_update(n);
+            if (n->max != max) {
+                return 7;
+            }
+        }
+
         if (n->left != rbt_end(t)) {
             rbt_enqueue(&queue, n->left);
         } 
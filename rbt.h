@@ -25,6 +25,11 @@ struct rbt_node_s {
 
     long key;
     long layer;
+    unsigned long size;     /* nodes in the subtree, 0 for nil */
+
+    /* interval tree: [key, end), max is the largest end in the subtree */
+    long end;
+    long max;
     rbt_node_t *prev;
     rbt_node_t *next;
 };
@@ -47,6 +52,7 @@ struct rbt_tree_s {
     rbt_node_t *nil;
     rbt_node_t sentinel;
     unsigned long size;
+    int interval;
 
     rbt_cmp_func_t cmp;
     rbt_free_func_t free;
@@ -62,7 +68,36 @@ void rbt_init(rbt_tree_t *t,
         rbt_bfs_func_t bfs);
 
 
-/* clear rb tree */
+/*
+ * interval tree mode, a node is the half open interval [key, end)
+ * ordered by key, every node keeps the max end of its subtree.
+ */
+void rbt_interval_init(rbt_tree_t *t, rbt_free_func_t free);
+
+/* return non zero to stop the query */
+typedef int (*rbt_interval_func_t)(rbt_node_t *n, void *arg);
+
+/*
+ * call func on every interval overlapping [lo, hi) in key order,
+ * func may be NULL to only count. the subtrees ending before lo or
+ * starting after hi are pruned, O(log n) per interval found.
+ * return the number of intervals found.
+ */
+long rbt_overlap(rbt_tree_t *t, long lo, long hi,
+        rbt_interval_func_t func, void *arg);
+
+/* the intervals containing point */
+long rbt_stab(rbt_tree_t *t, long point,
+        rbt_interval_func_t func, void *arg);
+
+/* any one interval overlapping [lo, hi) or nil, O(log n) */
+rbt_node_t *rbt_overlap_any(rbt_tree_t *t, long lo, long hi);
+
+/*
+ * free every node without recursion, r must be t->root: cutting out
+ * a lower subtree would leave its ancestors with a wrong black height,
+ * size and max.
+ */
 void rbt_clear(rbt_tree_t *t, rbt_node_t *r);
 
 /* destroy rb tree */
@@ -77,8 +112,45 @@ rbt_node_t *rbt_min(rbt_tree_t *t, rbt_node_t *min);
 rbt_node_t *rbt_max(rbt_tree_t *t, rbt_node_t *max);
 rbt_node_t *rbt_find(rbt_tree_t *t, rbt_node_t *n);
 
-/* rbt iterator function */
+/* rbt iterator functions, nil after the last or before the first */
 rbt_node_t *rbt_next(rbt_tree_t *t, rbt_node_t *n);
+rbt_node_t *rbt_prev(rbt_tree_t *t, rbt_node_t *n);
+
+/*
+ * rbt_lower_bound return the first node not less than n,
+ * rbt_upper_bound the first node greater than n, nil if none.
+ */
+rbt_node_t *rbt_lower_bound(rbt_tree_t *t, rbt_node_t *n);
+rbt_node_t *rbt_upper_bound(rbt_tree_t *t, rbt_node_t *n);
+
+/*
+ * cursor over a rb tree by the parent pointers, no stack is kept so
+ * next and prev are amortized O(1). node is nil past either end, prev
+ * from there steps to the last node like the end of a c++ map.
+ * the cursor node must not be deleted while the cursor is on it.
+ */
+typedef struct rbt_cursor_s {
+    rbt_tree_t *t;
+    rbt_node_t *node;
+} rbt_cursor_t;
+
+void rbt_cursor_init(rbt_tree_t *t, rbt_cursor_t *c);
+rbt_node_t *rbt_cursor_first(rbt_cursor_t *c);
+rbt_node_t *rbt_cursor_last(rbt_cursor_t *c);
+rbt_node_t *rbt_cursor_lower(rbt_cursor_t *c, rbt_node_t *n);
+rbt_node_t *rbt_cursor_upper(rbt_cursor_t *c, rbt_node_t *n);
+rbt_node_t *rbt_cursor_next(rbt_cursor_t *c);
+rbt_node_t *rbt_cursor_prev(rbt_cursor_t *c);
+
+/*
+ * order statistics by the subtree sizes, O(log n).
+ * rbt_select return the node at position i counting from 0, or nil.
+ * rbt_rank return the position of n, n must be in the tree.
+ * rbt_count_range count the nodes between lo and hi inclusive.
+ */
+rbt_node_t *rbt_select(rbt_tree_t *t, unsigned long i);
+unsigned long rbt_rank(rbt_tree_t *t, rbt_node_t *n);
+unsigned long rbt_count_range(rbt_tree_t *t, rbt_node_t *lo, rbt_node_t *hi);
 
 /* rbt transplant function */
 void rbt_transplant(rbt_tree_t *t, rbt_node_t *x, rbt_node_t *y);
@@ -86,6 +158,14 @@ void rbt_transplant(rbt_tree_t *t, rbt_node_t *x, rbt_node_t *y);
 /* rb tree insert */
 rbt_node_t *rbt_insert(rbt_tree_t *t, rbt_node_t *n);
 
+/*
+ * link n nodes already in key order into an empty tree in O(n),
+ * no cmp is called. the tree is perfectly balanced and the nodes
+ * of its deepest level are red.
+ * return -1 if the tree is not empty.
+ */
+int rbt_build_sorted(rbt_tree_t *t, rbt_node_t **nodes, unsigned long n);
+
 /* rb tree delete */
 rbt_node_t *rbt_delete(rbt_tree_t *t, rbt_node_t *z);
 
@@ -96,6 +176,7 @@ rbt_node_t *rbt_delete(rbt_tree_t *t, rbt_node_t *z);
  * t: tree which want to travel
  * r: is the root of the tree
  *
+ * the walks follow the parent pointers, no recursion and no stack.
  */
 void rbt_preorder(rbt_tree_t *t, rbt_node_t *r);
 void rbt_inorder(rbt_tree_t *t, rbt_node_t *r);
@@ -1,2 +1,227 @@
 #include "ring.h"
+#include "builtin.h"
+#include "sync.h"
+#include <string.h>
 
+enum ring_behavior_e {
+    RING_FIXED,     /* bulk */
+    RING_VARIABLE   /* burst */
+};
+
+ring_t *ring_create(uint32_t count, uint32_t flags)
+{
+    ring_t *r;
+    size_t size;
+
+    if (count < 2 || (count & (count - 1)) != 0 || count > RING_SZ_MASK) {
+        return NULL;
+    }
+
+    size = sizeof(ring_t) + count * sizeof(void *);
+    if (posix_memalign((void **)&r, RING_CACHE_LINE_SIZE, size) != 0) {
+        return NULL;
+    }
+    memset(r, 0, size);
+
+    r->flags = flags;
+    r->size = count;
+    r->mask = count - 1;
+    r->capacity = count - 1;
+    r->prod.single = !!(flags & RING_F_SP_ENQ);
+    r->cons.single = !!(flags & RING_F_SC_DEQ);
+
+    return r;
+}
+
+void ring_free(ring_t *r)
+{
+    free(r);
+}
+
+/*
+ * wait for the other threads which reserved slots before us,
+ * then publish our slots by moving the tail.
+ */
+static inline void _ring_update_tail(struct ring_headtail_s *ht,
+        uint32_t old_val, uint32_t new_val)
+{
+    if (!ht->single) {
+        while (__atomic_load_n(&ht->tail, __ATOMIC_RELAXED) != old_val) {
+            cpu_relax();
+        }
+    }
+
+    __atomic_store_n(&ht->tail, new_val, __ATOMIC_RELEASE);
+}
+
+static inline unsigned _ring_move_prod_head(ring_t *r, unsigned n,
+        enum ring_behavior_e behavior,
+        uint32_t *old_head, uint32_t *new_head)
+{
+    uint32_t cons_tail, free_entries;
+    unsigned max = n;
+    int success;
+
+    *old_head = __atomic_load_n(&r->prod.head, __ATOMIC_RELAXED);
+    do {
+        n = max;
+
+        /* make sure the head is read before the cons tail */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        cons_tail = __atomic_load_n(&r->cons.tail, __ATOMIC_ACQUIRE);
+        free_entries = r->capacity + cons_tail - *old_head;
+
+        if (unlikely(n > free_entries)) {
+            n = (behavior == RING_FIXED) ? 0 : free_entries;
+        }
+
+        if (n == 0) {
+            return 0;
+        }
+
+        *new_head = *old_head + n;
+        if (r->prod.single) {
+            r->prod.head = *new_head;
+            success = 1;
+        } else {
+            /* on failure old_head is reloaded */
+            success = __atomic_compare_exchange_n(&r->prod.head,
+                    old_head, *new_head, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    } while (unlikely(!success));
+
+    return n;
+}
+
+static inline unsigned _ring_move_cons_head(ring_t *r, unsigned n,
+        enum ring_behavior_e behavior,
+        uint32_t *old_head, uint32_t *new_head)
+{
+    uint32_t prod_tail, entries;
+    unsigned max = n;
+    int success;
+
+    *old_head = __atomic_load_n(&r->cons.head, __ATOMIC_RELAXED);
+    do {
+        n = max;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        prod_tail = __atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE);
+        entries = prod_tail - *old_head;
+
+        if (n > entries) {
+            n = (behavior == RING_FIXED) ? 0 : entries;
+        }
+
+        if (unlikely(n == 0)) {
+            return 0;
+        }
+
+        *new_head = *old_head + n;
+        if (r->cons.single) {
+            r->cons.head = *new_head;
+            success = 1;
+        } else {
+            success = __atomic_compare_exchange_n(&r->cons.head,
+                    old_head, *new_head, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    } while (unlikely(!success));
+
+    return n;
+}
+
+static inline void _ring_copy_in(ring_t *r, uint32_t head,
+        void * const *objs, unsigned n)
+{
+    uint32_t idx = head & r->mask;
+    unsigned i;
+
+    if (likely(idx + n <= r->size)) {
+        for (i = 0; i < n; i++) {
+            r->slot[idx + i] = objs[i];
+        }
+    } else {
+        for (i = 0; idx < r->size; i++, idx++) {
+            r->slot[idx] = objs[i];
+        }
+        for (idx = 0; i < n; i++, idx++) {
+            r->slot[idx] = objs[i];
+        }
+    }
+}
+
+static inline void _ring_copy_out(ring_t *r, uint32_t head,
+        void **objs, unsigned n)
+{
+    uint32_t idx = head & r->mask;
+    unsigned i;
+
+    if (likely(idx + n <= r->size)) {
+        for (i = 0; i < n; i++) {
+            objs[i] = r->slot[idx + i];
+        }
+    } else {
+        for (i = 0; idx < r->size; i++, idx++) {
+            objs[i] = r->slot[idx];
+        }
+        for (idx = 0; i < n; i++, idx++) {
+            objs[i] = r->slot[idx];
+        }
+    }
+}
+
+static inline unsigned _ring_do_enqueue(ring_t *r, void * const *objs,
+        unsigned n, enum ring_behavior_e behavior)
+{
+    uint32_t prod_head, prod_next;
+
+    n = _ring_move_prod_head(r, n, behavior, &prod_head, &prod_next);
+    if (n == 0) {
+        return 0;
+    }
+
+    _ring_copy_in(r, prod_head, objs, n);
+    _ring_update_tail(&r->prod, prod_head, prod_next);
+
+    return n;
+}
+
+static inline unsigned _ring_do_dequeue(ring_t *r, void **objs,
+        unsigned n, enum ring_behavior_e behavior)
+{
+    uint32_t cons_head, cons_next;
+
+    n = _ring_move_cons_head(r, n, behavior, &cons_head, &cons_next);
+    if (n == 0) {
+        return 0;
+    }
+
+    _ring_copy_out(r, cons_head, objs, n);
+    _ring_update_tail(&r->cons, cons_head, cons_next);
+
+    return n;
+}
+
+unsigned ring_enqueue_bulk(ring_t *r, void * const *objs, unsigned n)
+{
+    return _ring_do_enqueue(r, objs, n, RING_FIXED);
+}
+
+unsigned ring_enqueue_burst(ring_t *r, void * const *objs, unsigned n)
+{
+    return _ring_do_enqueue(r, objs, n, RING_VARIABLE);
+}
+
+unsigned ring_dequeue_bulk(ring_t *r, void **objs, unsigned n)
+{
+    return _ring_do_dequeue(r, objs, n, RING_FIXED);
+}
+
+unsigned ring_dequeue_burst(ring_t *r, void **objs, unsigned n)
+{
+    return _ring_do_dequeue(r, objs, n, RING_VARIABLE);
+}
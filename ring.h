@@ -1,4 +1,97 @@
 #ifndef RING_H
 #define RING_H
 
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * bounded lock-free ring of pointers, refer to the dpdk rte_ring.
+ *
+ * producers and consumers each own a head and a tail index:
+ *   1. move the head with a CAS (or a plain store in single mode)
+ *      to reserve n slots,
+ *   2. copy the objects in or out,
+ *   3. wait for the previous reservations to finish and then
+ *      publish by moving the tail.
+ *
+ * the indexes are free running 32 bits counters, only masked
+ * when touching the slots, so count must be power of two and
+ * the ring can store count - 1 objects.
+ */
+
+#define RING_CACHE_LINE_SIZE 64
+#define __ring_cache_aligned __attribute__((aligned(RING_CACHE_LINE_SIZE)))
+
+/* flags of ring_create */
+#define RING_F_SP_ENQ   0x0001  /* single producer */
+#define RING_F_SC_DEQ   0x0002  /* single consumer */
+
+#define RING_SZ_MASK    0x7fffffffU
+
+struct ring_headtail_s {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t single;
+};
+
+typedef struct ring_s {
+    uint32_t flags;
+    uint32_t size;
+    uint32_t mask;
+    uint32_t capacity;
+
+    /* keep producer and consumer on different cache lines */
+    struct ring_headtail_s prod __ring_cache_aligned;
+    struct ring_headtail_s cons __ring_cache_aligned;
+
+    void *slot[0] __ring_cache_aligned;
+} ring_t;
+
+/* count must be power of two, return NULL on error */
+ring_t *ring_create(uint32_t count, uint32_t flags);
+void ring_free(ring_t *r);
+
+/*
+ * bulk:  enqueue/dequeue exactly n objects or nothing.
+ * burst: enqueue/dequeue as many objects as possible, up to n.
+ * return the number of objects processed.
+ */
+unsigned ring_enqueue_bulk(ring_t *r, void * const *objs, unsigned n);
+unsigned ring_enqueue_burst(ring_t *r, void * const *objs, unsigned n);
+unsigned ring_dequeue_bulk(ring_t *r, void **objs, unsigned n);
+unsigned ring_dequeue_burst(ring_t *r, void **objs, unsigned n);
+
+/* return 0 on success, or -1 when ring is full or empty */
+static inline int ring_enqueue(ring_t *r, void *obj)
+{
+    return ring_enqueue_bulk(r, &obj, 1) ? 0 : -1;
+}
+
+static inline int ring_dequeue(ring_t *r, void **obj)
+{
+    return ring_dequeue_bulk(r, obj, 1) ? 0 : -1;
+}
+
+static inline unsigned ring_count(const ring_t *r)
+{
+    uint32_t count = (r->prod.tail - r->cons.tail) & r->mask;
+
+    return count > r->capacity ? r->capacity : count;
+}
+
+static inline unsigned ring_free_count(const ring_t *r)
+{
+    return r->capacity - ring_count(r);
+}
+
+static inline int ring_empty(const ring_t *r)
+{
+    return r->prod.tail == r->cons.tail;
+}
+
+static inline int ring_full(const ring_t *r)
+{
+    return ring_free_count(r) == 0;
+}
+
 #endif // RING_H
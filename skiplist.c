@@ -1,10 +1,110 @@
 #include "skiplist.h"
+#include "sync.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <sched.h>
+#include <inttypes.h>
+
+/* the default cmp is inlined, other cmp are called */
+static inline int _skiplist_cmp(skiplist_t *sl, skipnode_t *x, skipnode_t *y)
+{
+	if (sl->cmp == skiplist_default_cmp)
+		return (x->key > y->key) - (x->key < y->key);
+
+	return sl->cmp(x, y);
+}
+
+#define SKIPLIST_ARENA_HEAD	sizeof(void *)
+
+static inline int _skiplist_arena_level(int size)
+{
+	return (size - sizeof(skipnode_t)) /
+		(sizeof(skipnode_t *) + sizeof(unsigned int));
+}
+
+static void _skiplist_arena_drop(skiplist_arena_t *a)
+{
+	void *chunk, *next;
+
+	for (chunk = a->chunk; chunk != NULL; chunk = next) {
+		next = *(void **)chunk;
+		free(chunk);
+	}
+
+	memset(a, 0, sizeof(*a));
+}
+
+int skiplist_arena_init(skiplist_t *sl)
+{
+	if (sl->size != 0)
+		return -1;
+
+	if (sl->arena == NULL) {
+		sl->arena = calloc(1, sizeof(skiplist_arena_t));
+		if (sl->arena == NULL)
+			return -1;
+	}
+
+	sl->alloc = skiplist_arena_alloc;
+	sl->free = skiplist_arena_free;
+
+	return 0;
+}
+
+skipnode_t *skiplist_arena_alloc(skiplist_t *sl, int size)
+{
+	skiplist_arena_t *a = sl->arena;
+	int level = _skiplist_arena_level(size);
+	skipnode_t *n;
+	char *chunk;
+
+	size = (size + 7) & ~7;
+	if (size > SKIPLIST_ARENA_CHUNK_SIZE - (int)SKIPLIST_ARENA_HEAD)
+		return NULL;
+
+	if (level < SKIPLIST_ARENA_LEVELS && a->free[level] != NULL) {
+		n = a->free[level];
+		a->free[level] = n->forward[0];
+		memset(n, 0, size);
+		return n;
+	}
+
+	if (a->end - a->cur < size) {
+		chunk = malloc(SKIPLIST_ARENA_CHUNK_SIZE);
+		if (chunk == NULL)
+			return NULL;
+
+		*(void **)chunk = a->chunk;
+		a->chunk = chunk;
+		a->nchunk++;
+		a->cur = chunk + SKIPLIST_ARENA_HEAD;
+		a->end = chunk + SKIPLIST_ARENA_CHUNK_SIZE;
+	}
+
+	/* a fresh chunk is not zeroed */
+	n = (skipnode_t *)a->cur;
+	a->cur += size;
+	memset(n, 0, size);
+
+	return n;
+}
+
+void skiplist_arena_free(skiplist_t *sl, skipnode_t *ptr)
+{
+	skiplist_arena_t *a = sl->arena;
+	int level = ptr->level;
+
+	/* too big to be kept, it goes back with its chunk */
+	if (level <= 0 || level >= SKIPLIST_ARENA_LEVELS)
+		return;
+
+	ptr->forward[0] = a->free[level];
+	a->free[level] = ptr;
+}
 
 /* 
  * initialize a skip list 
@@ -31,15 +131,19 @@ void skiplist_init(skiplist_t *sl, int max_level)
 	sl->free = skiplist_default_free;
 	sl->random = skiplist_default_random;
 
+	sl->arena = NULL;
+
 	sl->max_level = max_level;
 	sl->level = 0;
 	sl->size = 0;
-	sl->head = sl->alloc(SKIPNODE_SIZE(sl->max_level));
-	sl->null = sl->alloc(SKIPNODE_SIZE(0));
-	sl->null->key = 0;
+	sl->head = sl->alloc(sl, SKIPNODE_SIZE(sl->max_level));
+	sl->head->level = sl->max_level;
+	sl->null = sl->alloc(sl, SKIPNODE_SIZE(0));
+	sl->null->key = INT64_MAX;
 
 	for (i = 0; i < sl->max_level; i++) {
 		sl->head->forward[i] = sl->null;
+		SKIPNODE_SPAN(sl->head)[i] = 0;
 	}
 }
 
@@ -50,6 +154,12 @@ void skiplist_clear(skiplist_t *sl)
 	skipnode_t *next;
 	int i;
 
+	if (sl->arena) {
+		_skiplist_arena_drop(sl->arena);
+		sl->size = 0;
+		head->forward[0] = sl->null;
+	}
+
 	/* only need free once */
 	while (head->forward[0] != sl->null) {
 		next = head->forward[0];
@@ -60,14 +170,20 @@ void skiplist_clear(skiplist_t *sl)
 	
 	for (i = 0; i < sl->max_level; i++) {
 		head->forward[i] = sl->null;
+		SKIPNODE_SPAN(head)[i] = 0;
 	}
+	sl->level = 0;
 }
 
 void skiplist_destroy(skiplist_t *sl)
 {
 	skiplist_clear(sl);
-	skiplist_default_free(sl->head);
-	skiplist_default_free(sl->null);
+	free(sl->arena);
+	sl->arena = NULL;
+
+	/* head and null always come from skiplist_default_alloc */
+	skiplist_default_free(sl, sl->head);
+	skiplist_default_free(sl, sl->null);
 	
 	sl->max_level = 0;
 	sl->level = 0;
@@ -77,22 +193,43 @@ void skiplist_destroy(skiplist_t *sl)
 	sl->cmp = NULL;
 }
 
-/* Recording search path with a given skip node */
+/*
+ * Recording search path with a given skip node,
+ * rank[i] is the position of pos[i] counted from the head (head is 0)
+ */
 static void _skiplist_position(skiplist_t *sl, 
 		skipnode_t **pos, /* length of pos is max_level */
+		unsigned int *rank,
 		skipnode_t *n)
 {
 	int i = 0;
 	skipnode_t *cur;
 	
-	for (i = sl->max_level - 1; i >= 0; i--) {
+	for (i = sl->max_level - 1; i >= sl->level; i--) {
 		pos[i] = sl->head;
+		rank[i] = 0;
 	}
 
 	cur = sl->head;
+	if (sl->cmp == skiplist_default_cmp) {
+		/* null holds the largest key, it stops every level */
+		for (i = sl->level - 1; i >= 0; i--) {
+			rank[i] = i == sl->level - 1 ? 0 : rank[i + 1];
+			while (cur->forward[i]->key < n->key) {
+				rank[i] += SKIPNODE_SPAN(cur)[i];
+				cur = cur->forward[i];
+			}
+
+			pos[i] = cur;
+		}
+		return;
+	}
+
 	for (i = sl->level - 1; i >= 0; i--) {
+		rank[i] = i == sl->level - 1 ? 0 : rank[i + 1];
 		while (cur->forward[i] != sl->null &&
 				sl->cmp(n, cur->forward[i]) > 0) {
+			rank[i] += SKIPNODE_SPAN(cur)[i];
 			cur = cur->forward[i];
 		}
 
@@ -117,15 +254,27 @@ skipnode_t *skiplist_find(skiplist_t *sl, skipnode_t *n)
 	ret = pos[0]->forward[0];
 
 	if (ret != sl->null &&
-			sl->cmp(n, ret) == 0) {
+			_skiplist_cmp(sl, n, ret) == 0) {
 		return ret;
 	}
 #else
 	int i = 0;
-	skipnode_t *cur;
+	skipnode_t *cur, *next;
 	int v;
 
 	cur = sl->head;
+	if (sl->cmp == skiplist_default_cmp) {
+		/* null holds the largest key, it stops every level */
+		next = sl->null;
+		for (i = sl->level - 1; i >= 0; i--) {
+			while ((next = cur->forward[i])->key < n->key) {
+				cur = next;
+			}
+		}
+
+		return next != sl->null && next->key == n->key ? next : NULL;
+	}
+
 	for (i = sl->level - 1; i >= 0; i--) {
 		while (cur->forward[i] != sl->null) {
 			v = sl->cmp(n, cur->forward[i]);
@@ -143,6 +292,71 @@ skipnode_t *skiplist_find(skiplist_t *sl, skipnode_t *n)
 	return NULL;
 }
 
+/*
+ * the searches of one group advance one hop each in turn, the node
+ * a search compares next is prefetched while the others hop, so up
+ * to SKIPLIST_BATCH cache misses are in flight at once.
+ * */
+int skiplist_find_batch(skiplist_t *sl, skipnode_t **keys,
+		skipnode_t **ret, int n)
+{
+	skipnode_t *cur[SKIPLIST_BATCH];
+	int level[SKIPLIST_BATCH];
+	int id[SKIPLIST_BATCH];
+	skipnode_t *next;
+	int base, active, found = 0;
+	int i, k;
+
+	for (base = 0; base < n; base += SKIPLIST_BATCH) {
+		active = n - base < SKIPLIST_BATCH ? n - base : SKIPLIST_BATCH;
+		for (i = 0; i < active; i++) {
+			id[i] = base + i;
+			cur[i] = sl->head;
+			level[i] = sl->level - 1;
+			ret[base + i] = NULL;
+		}
+
+		while (active > 0) {
+			for (i = 0; i < active; i++) {
+				k = id[i];
+				if (level[i] < 0) {
+					/* empty list */
+					next = sl->null;
+				} else {
+					next = cur[i]->forward[level[i]];
+					if (next != sl->null &&
+							_skiplist_cmp(sl, keys[k], next) > 0) {
+						cur[i] = next;
+						__builtin_prefetch(next->forward[level[i]]);
+						continue;
+					}
+				}
+
+				if (level[i] > 0) {
+					level[i]--;
+					__builtin_prefetch(cur[i]->forward[level[i]]);
+					continue;
+				}
+
+				/* done, the last search of the group takes its slot */
+				if (next != sl->null &&
+						_skiplist_cmp(sl, keys[k], next) == 0) {
+					ret[k] = next;
+					found++;
+				}
+
+				active--;
+				cur[i] = cur[active];
+				level[i] = level[active];
+				id[i] = id[active];
+				i--;
+			}
+		}
+	}
+
+	return found;
+}
+
 /*
  * Insert the skipnode into skiplist.
  * if skipnode has been exist then return it.
@@ -152,12 +366,13 @@ skipnode_t *skiplist_insert(skiplist_t *sl, skipnode_t *n)
 {
 	int i;
 	skipnode_t *pos[sl->max_level];
+	unsigned int rank[sl->max_level];
 
-	_skiplist_position(sl, pos, n);
+	_skiplist_position(sl, pos, rank, n);
 	
 	/* exist then return it */
 	if (pos[0]->forward[0] != sl->null &&
-			sl->cmp(n, pos[0]->forward[0]) == 0) {
+			_skiplist_cmp(sl, n, pos[0]->forward[0]) == 0) {
 		return pos[0]->forward[0];
 	}
 
@@ -165,13 +380,22 @@ skipnode_t *skiplist_insert(skiplist_t *sl, skipnode_t *n)
 	/* make search path completely */
 	for (i = sl->level; i < n->level; i++) {
 		pos[sl->level] = sl->head;
+		SKIPNODE_SPAN(sl->head)[sl->level] = sl->size;
 		sl->level++;
 	}
 
-	/* update forward pointer */
+	/* update forward pointer, n sits at rank[0] + 1 */
 	for (i = 0; i < n->level; i++) {
 		n->forward[i] = pos[i]->forward[i];
 		pos[i]->forward[i] = n;
+
+		SKIPNODE_SPAN(n)[i] = SKIPNODE_SPAN(pos[i])[i] - (rank[0] - rank[i]);
+		SKIPNODE_SPAN(pos[i])[i] = rank[0] - rank[i] + 1;
+	}
+
+	/* the higher links now jump over n as well */
+	for (; i < sl->level; i++) {
+		SKIPNODE_SPAN(pos[i])[i]++;
 	}
 
 	sl->size++;
@@ -184,25 +408,30 @@ skipnode_t *skiplist_remove(skiplist_t *sl, skipnode_t *n)
 	int i;
 	int level;
 	skipnode_t *pos[sl->max_level];
+	unsigned int rank[sl->max_level];
 	skipnode_t *ret;
 
-	_skiplist_position(sl, pos, n);
+	_skiplist_position(sl, pos, rank, n);
 	
 	ret = pos[0]->forward[0];
 
 	/* not exist then return NULL */
 	if (ret == sl->null ||
-			sl->cmp(n, ret) != 0) {
+			_skiplist_cmp(sl, n, ret) != 0) {
 		return NULL;
 	}
 	
 	/* update forward pointer 
-	 * Note: updating only when next forward equal ret
+	 * Note: updating only when next forward equal ret,
+	 *       the higher links just jump over one node less
 	 * */
 	for (i = 0; i < sl->level; i++) {
-		if (pos[i]->forward[i] != ret)
-			break;
-		pos[i]->forward[i] = ret->forward[i];
+		if (pos[i]->forward[i] == ret) {
+			SKIPNODE_SPAN(pos[i])[i] += SKIPNODE_SPAN(ret)[i] - 1;
+			pos[i]->forward[i] = ret->forward[i];
+		} else {
+			SKIPNODE_SPAN(pos[i])[i]--;
+		}
 	}
 
 	/* update skiplist's level */
@@ -218,9 +447,557 @@ skipnode_t *skiplist_remove(skiplist_t *sl, skipnode_t *n)
 	return ret;
 }
 
+/*
+ * position before lo, or the head when lo is NULL,
+ * the range is cut out with this one path.
+ * */
+long skiplist_remove_range(skiplist_t *sl, skipnode_t *lo, skipnode_t *hi)
+{
+	skipnode_t *pos[sl->max_level];
+	unsigned int rank[sl->max_level];
+	long target[sl->max_level];
+	skipnode_t *x, *next;
+	long rx, k = 0;
+	int i;
+
+	if (lo) {
+		_skiplist_position(sl, pos, rank, lo);
+	} else {
+		for (i = 0; i < sl->max_level; i++) {
+			pos[i] = sl->head;
+			rank[i] = 0;
+		}
+	}
+
+	for (i = 0; i < sl->level; i++)
+		target[i] = -1;
+
+	/* pos[i] stays the predecessor on level i of every node cut out */
+	rx = rank[0];
+	for (x = pos[0]->forward[0]; x != sl->null; x = next) {
+		if (hi && _skiplist_cmp(sl, x, hi) > 0)
+			break;
+
+		next = x->forward[0];
+		rx++;
+		for (i = 0; i < x->level; i++) {
+			pos[i]->forward[i] = x->forward[i];
+			target[i] = rx + SKIPNODE_SPAN(x)[i];
+		}
+
+		k++;
+		if (sl->arena)
+			sl->free(sl, x);
+		else
+			sl->clr(x);
+	}
+
+	if (k == 0)
+		return 0;
+
+	/* the new link of a cut level jumps to where the last cut node jumped */
+	for (i = 0; i < sl->level; i++) {
+		if (target[i] >= 0)
+			SKIPNODE_SPAN(pos[i])[i] = target[i] - rank[i] - k;
+		else
+			SKIPNODE_SPAN(pos[i])[i] -= k;
+	}
+
+	while (sl->level > 0 && sl->head->forward[sl->level - 1] == sl->null)
+		sl->level--;
+
+	sl->size -= k;
+
+	return k;
+}
+
+void skiplist_cursor_seek(skiplist_t *sl, skiplist_cursor_t *c,
+		skipnode_t *lo, skipnode_t *hi)
+{
+	skipnode_t *pos[sl->max_level];
+	unsigned int rank[sl->max_level];
+
+	c->sl = sl;
+	c->hi = hi;
+
+	if (lo) {
+		_skiplist_position(sl, pos, rank, lo);
+		c->node = pos[0]->forward[0];
+	} else {
+		c->node = sl->head->forward[0];
+	}
+}
+
+skipnode_t *skiplist_cursor_next(skiplist_cursor_t *c)
+{
+	skipnode_t *n = c->node;
+
+	if (n == c->sl->null ||
+			(c->hi && _skiplist_cmp(c->sl, n, c->hi) > 0))
+		return NULL;
+
+	c->node = n->forward[0];
+
+	return n;
+}
+
+long skiplist_rank(skiplist_t *sl, skipnode_t *n)
+{
+	skipnode_t *cur = sl->head;
+	long rank = 0;
+	int i, v;
+
+	for (i = sl->level - 1; i >= 0; i--) {
+		while (cur->forward[i] != sl->null) {
+			v = _skiplist_cmp(sl, n, cur->forward[i]);
+			if (v < 0)
+				break;
+
+			rank += SKIPNODE_SPAN(cur)[i];
+			cur = cur->forward[i];
+			if (v == 0)
+				return rank - 1;
+		}
+	}
+
+	return -1;
+}
+
+skipnode_t *skiplist_at(skiplist_t *sl, long idx)
+{
+	skipnode_t *cur = sl->head;
+	long traversed = 0;
+	int i;
+
+	if (idx < 0 || idx >= sl->size)
+		return NULL;
+
+	/* the node at idx is idx + 1 steps away from the head */
+	for (i = sl->level - 1; i >= 0; i--) {
+		while (cur->forward[i] != sl->null &&
+				traversed + SKIPNODE_SPAN(cur)[i] <= idx + 1) {
+			traversed += SKIPNODE_SPAN(cur)[i];
+			cur = cur->forward[i];
+		}
+
+		if (traversed == idx + 1)
+			return cur;
+	}
+
+	return NULL;
+}
+
+long skiplist_range_by_rank(skiplist_t *sl, long start, long count,
+		skipnode_t **nodes)
+{
+	skipnode_t *cur = skiplist_at(sl, start);
+	long i;
+
+	for (i = 0; i < count && cur != NULL && cur != sl->null; i++) {
+		nodes[i] = cur;
+		cur = cur->forward[0];
+	}
+
+	return i;
+}
+
+/*
+ * lock free skip list, Fraser and Herlihy style.
+ *
+ * the low bit of forward[i] marks the node as deleted on level i,
+ * a marked forward pointer never changes again.
+ * n->level carries two flags while the node is in the list:
+ *     INSERTING: the inserter is still linking the upper levels
+ *     DELETED:   the remover has marked every level
+ * whoever clears the last of them unlinks and retires the node, so
+ * the node can not be linked again by a late inserter after it was
+ * handed to the reclaimer.
+ */
+/*
+ * build with -DSKIPLIST_SYNC_YIELD to give the cpu away before every
+ * CAS on the list, so a stress test hits the races even on one core.
+ */
+#ifdef SKIPLIST_SYNC_YIELD
+#define _skiplist_cas(p, o, n) (sched_yield(), bcas(p, o, n))
+#else
+#define _skiplist_cas(p, o, n) bcas(p, o, n)
+#endif
+
+#define SKIPLIST_MARKED(p) ((uintptr_t)(p) & 1)
+#define SKIPLIST_MARK(p)   ((skipnode_t *)((uintptr_t)(p) | 1))
+#define SKIPLIST_UNMARK(p) ((skipnode_t *)((uintptr_t)(p) & ~(uintptr_t)1))
+
+#define SKIPLIST_LOAD(p)   __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+/*
+ * epoch based reclamation.
+ * a thread publishes the global epoch it saw when it enters a call,
+ * the epoch only moves on when every thread inside a call has seen
+ * the current one. a node retired in epoch e is unlinked already, so
+ * once the epoch reaches e + 2 nobody can hold it.
+ */
+#define SKIPLIST_SYNC_MAX_THREADS  256
+#define SKIPLIST_SYNC_RETIRE_BATCH 64
+
+typedef struct _skiplist_epoch_slot_s {
+	volatile uint64_t epoch;
+	volatile int active;
+	volatile int used;
+} __attribute__((aligned(64))) _skiplist_epoch_slot_t;
+
+typedef struct _skiplist_retired_s {
+	skipnode_t *node;
+	skiplist_clr_func_t clr;
+	uint64_t epoch;
+} _skiplist_retired_t;
+
+static volatile uint64_t _skiplist_epoch;
+static _skiplist_epoch_slot_t _skiplist_slots[SKIPLIST_SYNC_MAX_THREADS];
+
+static __thread _skiplist_epoch_slot_t *_skiplist_slot;
+static __thread _skiplist_retired_t *_skiplist_limbo;
+static __thread int _skiplist_nlimbo;
+static __thread int _skiplist_limbo_size;
+static __thread int _skiplist_nretire;
+static __thread int _skiplist_depth;	/* nested enters of this thread */
+
+static void _skiplist_epoch_enter(void)
+{
+	_skiplist_epoch_slot_t *s = _skiplist_slot;
+	int i;
+
+	/* an inner enter keeps the epoch of the outer one */
+	if (_skiplist_depth++ > 0)
+		return;
+
+	while (s == NULL) {
+		for (i = 0; i < SKIPLIST_SYNC_MAX_THREADS; i++) {
+			if (__atomic_load_n(&_skiplist_slots[i].used, __ATOMIC_RELAXED) == 0 &&
+					bcas(&_skiplist_slots[i].used, 0, 1)) {
+				s = &_skiplist_slots[i];
+				break;
+			}
+		}
+
+		/* all slots taken, wait for a thread to exit */
+		if (s == NULL)
+			sched_yield();
+	}
+	_skiplist_slot = s;
+
+	__atomic_store_n(&s->active, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&s->epoch,
+			__atomic_load_n(&_skiplist_epoch, __ATOMIC_SEQ_CST),
+			__ATOMIC_SEQ_CST);
+}
+
+static void _skiplist_epoch_exit(void)
+{
+	if (--_skiplist_depth > 0)
+		return;
+
+	__atomic_store_n(&_skiplist_slot->active, 0, __ATOMIC_RELEASE);
+}
+
+void skiplist_sync_enter(void)
+{
+	_skiplist_epoch_enter();
+}
+
+void skiplist_sync_exit(void)
+{
+	_skiplist_epoch_exit();
+}
+
+static uint64_t _skiplist_epoch_advance(void)
+{
+	uint64_t e = __atomic_load_n(&_skiplist_epoch, __ATOMIC_SEQ_CST);
+	_skiplist_epoch_slot_t *s;
+	int i;
+
+	for (i = 0; i < SKIPLIST_SYNC_MAX_THREADS; i++) {
+		s = &_skiplist_slots[i];
+		if (__atomic_load_n(&s->used, __ATOMIC_SEQ_CST) &&
+				__atomic_load_n(&s->active, __ATOMIC_SEQ_CST) &&
+				__atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST) != e) {
+			return e;
+		}
+	}
+
+	if (bcas(&_skiplist_epoch, e, e + 1))
+		e++;
+
+	return e;
+}
+
+/* free the retired nodes nobody can see any more */
+static void _skiplist_epoch_collect(void)
+{
+	uint64_t e = _skiplist_epoch_advance();
+	int i, j;
+
+	for (i = 0; i < _skiplist_nlimbo; i++) {
+		if (_skiplist_limbo[i].epoch + 2 > e)
+			break;
+		_skiplist_limbo[i].clr(_skiplist_limbo[i].node);
+	}
+
+	for (j = 0; i < _skiplist_nlimbo; i++, j++)
+		_skiplist_limbo[j] = _skiplist_limbo[i];
+	_skiplist_nlimbo = j;
+}
+
+static void _skiplist_epoch_retire(skipnode_t *n, skiplist_clr_func_t clr)
+{
+	_skiplist_retired_t *limbo;
+	int size;
+
+	if (_skiplist_nlimbo == _skiplist_limbo_size) {
+		size = _skiplist_limbo_size ? _skiplist_limbo_size * 2 :
+			SKIPLIST_SYNC_RETIRE_BATCH;
+		limbo = realloc(_skiplist_limbo, size * sizeof(*limbo));
+		if (limbo == NULL) {
+			/* keep the node alive rather than free it too early */
+			return;
+		}
+		_skiplist_limbo = limbo;
+		_skiplist_limbo_size = size;
+	}
+
+	_skiplist_limbo[_skiplist_nlimbo].node = n;
+	_skiplist_limbo[_skiplist_nlimbo].clr = clr;
+	_skiplist_limbo[_skiplist_nlimbo].epoch =
+		__atomic_load_n(&_skiplist_epoch, __ATOMIC_SEQ_CST);
+	_skiplist_nlimbo++;
+
+	if (++_skiplist_nretire >= SKIPLIST_SYNC_RETIRE_BATCH) {
+		_skiplist_nretire = 0;
+		_skiplist_epoch_collect();
+	}
+}
+
+void skiplist_sync_thread_exit(void)
+{
+	if (_skiplist_slot == NULL)
+		return;
+
+	while (_skiplist_nlimbo > 0) {
+		_skiplist_epoch_collect();
+		if (_skiplist_nlimbo > 0)
+			sched_yield();
+	}
+
+	free(_skiplist_limbo);
+	_skiplist_limbo = NULL;
+	_skiplist_limbo_size = 0;
+	_skiplist_nretire = 0;
+
+	__atomic_store_n(&_skiplist_slot->used, 0, __ATOMIC_RELEASE);
+	_skiplist_slot = NULL;
+}
+
+/*
+ * search path of n like _skiplist_position, and snip the marked
+ * nodes on the way. past walks over the nodes equal to n as well,
+ * it is used to unlink a removed node which may sit behind a newer
+ * node with the same key.
+ * return true if an unmarked node equal to n is succs[0].
+ */
+static int _skiplist_sync_search(skiplist_t *sl, skipnode_t *n,
+		skipnode_t **preds, skipnode_t **succs, int past)
+{
+	skipnode_t *pred, *curr, *succ;
+	int i, v;
+
+retry:
+	pred = sl->head;
+	for (i = sl->max_level - 1; i >= 0; i--) {
+		curr = SKIPLIST_UNMARK(SKIPLIST_LOAD(pred->forward[i]));
+		while (curr != sl->null) {
+			succ = SKIPLIST_LOAD(curr->forward[i]);
+			if (SKIPLIST_MARKED(succ)) {
+				if (!_skiplist_cas(&pred->forward[i], curr, SKIPLIST_UNMARK(succ)))
+					goto retry;
+				curr = SKIPLIST_UNMARK(succ);
+				continue;
+			}
+
+			v = _skiplist_cmp(sl, n, curr);
+			if (v < 0 || (v == 0 && !past))
+				break;
+
+			pred = curr;
+			curr = succ;
+		}
+
+		preds[i] = pred;
+		succs[i] = curr;
+	}
+
+	return succs[0] != sl->null && _skiplist_cmp(sl, n, succs[0]) == 0;
+}
+
+static void _skiplist_sync_reclaim(skiplist_t *sl, skipnode_t *n)
+{
+	skipnode_t *preds[sl->max_level];
+	skipnode_t *succs[sl->max_level];
+
+	_skiplist_sync_search(sl, n, preds, succs, true);
+	_skiplist_epoch_retire(n, sl->clr);
+}
+
+/*
+ * readers never write, they step over the marked nodes.
+ * the upper levels are marked before level 0, so an unmarked node
+ * found on any level is still in the list.
+ */
+skipnode_t *skiplist_sync_find(skiplist_t *sl, skipnode_t *n)
+{
+	skipnode_t *pred, *curr, *succ;
+	skipnode_t *ret = NULL;
+	int i, v;
+
+	_skiplist_epoch_enter();
+
+	pred = sl->head;
+	for (i = SKIPLIST_LOAD(sl->level) - 1; i >= 0; i--) {
+		curr = SKIPLIST_UNMARK(SKIPLIST_LOAD(pred->forward[i]));
+		while (curr != sl->null) {
+			succ = SKIPLIST_LOAD(curr->forward[i]);
+			if (SKIPLIST_MARKED(succ)) {
+				curr = SKIPLIST_UNMARK(succ);
+				continue;
+			}
+
+			v = _skiplist_cmp(sl, n, curr);
+			if (v == 0) {
+				ret = curr;
+				goto out;
+			} else if (v < 0) {
+				break;
+			}
+
+			pred = curr;
+			curr = succ;
+		}
+	}
+
+out:
+	_skiplist_epoch_exit();
+
+	return ret;
+}
+
+/*
+ * link level 0 first, that is the moment n is in the list,
+ * then link the upper levels one by one, giving up when n is
+ * being removed meanwhile.
+ */
+skipnode_t *skiplist_sync_insert(skiplist_t *sl, skipnode_t *n)
+{
+	skipnode_t *preds[sl->max_level];
+	skipnode_t *succs[sl->max_level];
+	skipnode_t *succ;
+	int level = n->level & SKIPNODE_LEVEL_MASK;
+	int top;
+	int i, old;
+
+	n->level = level | SKIPNODE_SYNC_INSERTING;
+
+	_skiplist_epoch_enter();
+
+	for (;;) {
+		if (_skiplist_sync_search(sl, n, preds, succs, false)) {
+			n->level = level;
+			_skiplist_epoch_exit();
+			return succs[0];
+		}
+
+		for (i = 0; i < level; i++)
+			n->forward[i] = succs[i];
+
+		if (_skiplist_cas(&preds[0]->forward[0], succs[0], n))
+			break;
+	}
+
+	__sync_fetch_and_add(&sl->size, 1);
+	top = SKIPLIST_LOAD(sl->level);
+	while (top < level && !_skiplist_cas(&sl->level, top, level))
+		top = SKIPLIST_LOAD(sl->level);
+
+	for (i = 1; i < level; i++) {
+		for (;;) {
+			succ = SKIPLIST_LOAD(n->forward[i]);
+			if (SKIPLIST_MARKED(succ))
+				goto done;
+			if (succ != succs[i] && !_skiplist_cas(&n->forward[i], succ, succs[i]))
+				goto done;
+			if (_skiplist_cas(&preds[i]->forward[i], succs[i], n))
+				break;
+
+			_skiplist_sync_search(sl, n, preds, succs, false);
+			if (succs[0] != n)
+				goto done;
+		}
+	}
+
+done:
+	old = __sync_fetch_and_and(&n->level, ~SKIPNODE_SYNC_INSERTING);
+	if (old & SKIPNODE_SYNC_DELETED)
+		_skiplist_sync_reclaim(sl, n);
+
+	_skiplist_epoch_exit();
+
+	return n;
+}
+
+skipnode_t *skiplist_sync_remove(skiplist_t *sl, skipnode_t *n)
+{
+	skipnode_t *preds[sl->max_level];
+	skipnode_t *succs[sl->max_level];
+	skipnode_t *ret, *succ;
+	int i, old;
+
+	_skiplist_epoch_enter();
+
+	if (!_skiplist_sync_search(sl, n, preds, succs, false)) {
+		_skiplist_epoch_exit();
+		return NULL;
+	}
+
+	ret = succs[0];
+	for (i = (SKIPLIST_LOAD(ret->level) & SKIPNODE_LEVEL_MASK) - 1; i > 0; i--) {
+		do {
+			succ = SKIPLIST_LOAD(ret->forward[i]);
+		} while (!SKIPLIST_MARKED(succ) &&
+				!_skiplist_cas(&ret->forward[i], succ, SKIPLIST_MARK(succ)));
+	}
+
+	for (;;) {
+		succ = SKIPLIST_LOAD(ret->forward[0]);
+		if (SKIPLIST_MARKED(succ)) {
+			/* another thread removed it first */
+			_skiplist_epoch_exit();
+			return NULL;
+		}
+		if (_skiplist_cas(&ret->forward[0], succ, SKIPLIST_MARK(succ)))
+			break;
+	}
+
+	__sync_fetch_and_sub(&sl->size, 1);
+
+	old = __sync_fetch_and_or(&ret->level, SKIPNODE_SYNC_DELETED);
+	if (!(old & SKIPNODE_SYNC_INSERTING))
+		_skiplist_sync_reclaim(sl, ret);
+
+	_skiplist_epoch_exit();
+
+	return ret;
+}
+
 int skiplist_default_cmp(skipnode_t *x, skipnode_t *y)
 {
-	return x->key - y->key;
+	return (x->key > y->key) - (x->key < y->key);
 }
 
 void skiplist_default_clr(skipnode_t *x)
@@ -228,6 +1005,32 @@ void skiplist_default_clr(skipnode_t *x)
 	free(x);
 }
 
+/*
+ * per thread wyrand, no lock and no shared cache line.
+ * seeded on the first call from the address of the thread local
+ * state and the time, so every thread gets its own sequence.
+ */
+static __thread uint64_t _skiplist_rand_state;
+
+static inline uint64_t _skiplist_rand64(void)
+{
+	__uint128_t t;
+
+	if (__builtin_expect(_skiplist_rand_state == 0, 0)) {
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		_skiplist_rand_state = ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec)
+			^ (uintptr_t)&_skiplist_rand_state;
+	}
+
+	_skiplist_rand_state += 0xa0761d6478bd642fULL;
+	t = (__uint128_t)_skiplist_rand_state
+		* (_skiplist_rand_state ^ 0xe7037ed1a0b428dbULL);
+
+	return (uint64_t)(t >> 64) ^ (uint64_t)t;
+}
+
 /*
  * when insert a element, the level at least 1
  * and the probability of increasement is 0.25
@@ -241,32 +1044,295 @@ void skiplist_default_clr(skipnode_t *x)
  * level 3: p**2 * (1-p)
  * level 4: p**3 * (1-p)
  * level k: p**(k-1) * (1-p)
+ *
+ * p = 1 / 2**SKIPLIST_P_BITS, going up one level needs
+ * SKIPLIST_P_BITS more zero bits, so one 64 bits draw and a count
+ * trailing zeros give the level. other p compare 16 bits a level.
  * */
-int skiplist_default_random(skiplist_t *sl)
+static int _skiplist_random_level(int max_level)
 {
-	int max = sl->max_level;
-	int level = 1;
-	
-	while ((random() & 0xFFFF) < (0xFFFF * SKIPLIST_P / 100))
+	uint64_t r = _skiplist_rand64();
+	int level;
+
+#ifdef SKIPLIST_P_BITS
+	level = 1 + __builtin_ctzll(r | (1ULL << 63)) / SKIPLIST_P_BITS;
+#else
+	int shift = 0;
+
+	level = 1;
+	while (((r >> shift) & 0xFFFF) < (0xFFFF * SKIPLIST_P / 100)) {
 		level++;
+		shift += 16;
+		if (shift == 64) {
+			r = _skiplist_rand64();
+			shift = 0;
+		}
+	}
+#endif
 
-	if (level > sl->max_level) {
-		level = sl->max_level;
+	if (level > max_level) {
+		level = max_level;
 	}
 
 	return level;
 }
 
-skipnode_t *skiplist_default_alloc(int size)
+int skiplist_default_random(skiplist_t *sl)
+{
+	return _skiplist_random_level(sl->max_level);
+}
+
+skipnode_t *skiplist_default_alloc(skiplist_t *sl, int size)
 {
+	(void)sl;
 	return calloc(1, size);
 }
 
-void skiplist_default_free(skipnode_t *ptr)
+void skiplist_default_free(skiplist_t *sl, skipnode_t *ptr)
 {
+	(void)sl;
 	free(ptr);
 }
 
+static uskipblock_t *_uskipblock_alloc(int level)
+{
+	uskipblock_t *b;
+
+	if (posix_memalign((void **)&b, 64, USKIPBLOCK_SIZE(level)) != 0)
+		return NULL;
+
+	memset(b, 0, USKIPBLOCK_SIZE(level));
+	b->level = level;
+
+	return b;
+}
+
+int uskiplist_init(uskiplist_t *l, int max_level)
+{
+	l->max_level = max_level;
+	l->level = 0;
+	l->size = 0;
+	l->nblock = 0;
+	l->head = _uskipblock_alloc(max_level);
+
+	return l->head ? 0 : -1;
+}
+
+void uskiplist_clear(uskiplist_t *l)
+{
+	uskipblock_t *b, *next;
+	int i;
+
+	for (b = l->head->forward[0]; b != NULL; b = next) {
+		next = b->forward[0];
+		free(b);
+	}
+
+	for (i = 0; i < l->max_level; i++)
+		l->head->forward[i] = NULL;
+
+	l->level = 0;
+	l->size = 0;
+	l->nblock = 0;
+}
+
+void uskiplist_destroy(uskiplist_t *l)
+{
+	uskiplist_clear(l);
+	free(l->head);
+	l->head = NULL;
+}
+
+/* the last block whose first key is not greater than key, head if none */
+static uskipblock_t *_uskiplist_position(uskiplist_t *l, int64_t key,
+		uskipblock_t **pos)
+{
+	uskipblock_t *cur = l->head, *next;
+	int i;
+
+	for (i = l->max_level - 1; i >= l->level; i--)
+		pos[i] = l->head;
+
+	for (i = l->level - 1; i >= 0; i--) {
+		while ((next = cur->forward[i]) != NULL && next->key[0] <= key)
+			cur = next;
+		pos[i] = cur;
+	}
+
+	return cur;
+}
+
+/* the nodes linking to b, b starts with k0 */
+static void _uskiplist_preds(uskiplist_t *l, int64_t k0,
+		uskipblock_t **preds)
+{
+	uskipblock_t *cur = l->head, *next;
+	int i;
+
+	for (i = l->level - 1; i >= 0; i--) {
+		while ((next = cur->forward[i]) != NULL && next->key[0] < k0)
+			cur = next;
+		preds[i] = cur;
+	}
+}
+
+static void _uskiplist_unlink(uskiplist_t *l, uskipblock_t *b,
+		uskipblock_t **preds)
+{
+	int i;
+
+	for (i = 0; i < b->level; i++)
+		preds[i]->forward[i] = b->forward[i];
+
+	while (l->level > 0 && l->head->forward[l->level - 1] == NULL)
+		l->level--;
+
+	l->nblock--;
+	free(b);
+}
+
+static inline int _uskipblock_lower(uskipblock_t *b, int64_t key)
+{
+	int i;
+
+	for (i = 0; i < b->n && b->key[i] < key; i++);
+
+	return i;
+}
+
+int uskiplist_find(uskiplist_t *l, int64_t key, void **value)
+{
+	uskipblock_t *cur = l->head, *next;
+	int i;
+
+	for (i = l->level - 1; i >= 0; i--) {
+		while ((next = cur->forward[i]) != NULL && next->key[0] <= key)
+			cur = next;
+	}
+
+	i = _uskipblock_lower(cur, key);
+	if (i == cur->n || cur->key[i] != key)
+		return -1;
+
+	if (value)
+		*value = USKIPBLOCK_VALUE(cur)[i];
+
+	return 0;
+}
+
+int uskiplist_insert(uskiplist_t *l, int64_t key, void *value)
+{
+	uskipblock_t *pos[l->max_level];
+	uskipblock_t *b, *nb;
+	int idx, half, level, i;
+
+	b = _uskiplist_position(l, key, pos);
+	if (b == l->head) {
+		/* key is less than every key, it goes to the first block */
+		b = l->head->forward[0];
+		if (b == NULL) {
+			level = _skiplist_random_level(l->max_level);
+			b = _uskipblock_alloc(level);
+			if (b == NULL)
+				return -1;
+
+			for (i = 0; i < level; i++)
+				l->head->forward[i] = b;
+			l->level = level;
+			l->nblock++;
+		}
+
+		for (i = 0; i < b->level; i++)
+			pos[i] = b;
+	}
+
+	idx = _uskipblock_lower(b, key);
+	if (idx < b->n && b->key[idx] == key) {
+		USKIPBLOCK_VALUE(b)[idx] = value;
+		return 1;
+	}
+
+	if (b->n == USKIPLIST_KEYS) {
+		level = _skiplist_random_level(l->max_level);
+		nb = _uskipblock_alloc(level);
+		if (nb == NULL)
+			return -1;
+
+		/* the upper half moves to the new block right after b */
+		half = (USKIPLIST_KEYS + 1) / 2;
+		nb->n = b->n - half;
+		memcpy(nb->key, &b->key[half], nb->n * sizeof(int64_t));
+		memcpy(USKIPBLOCK_VALUE(nb), &USKIPBLOCK_VALUE(b)[half],
+				nb->n * sizeof(void *));
+		b->n = half;
+
+		for (i = 0; i < level; i++) {
+			nb->forward[i] = pos[i]->forward[i];
+			pos[i]->forward[i] = nb;
+		}
+		if (level > l->level)
+			l->level = level;
+		l->nblock++;
+
+		if (idx > half) {
+			b = nb;
+			idx -= half;
+		}
+	}
+
+	memmove(&b->key[idx + 1], &b->key[idx],
+			(b->n - idx) * sizeof(int64_t));
+	memmove(&USKIPBLOCK_VALUE(b)[idx + 1], &USKIPBLOCK_VALUE(b)[idx],
+			(b->n - idx) * sizeof(void *));
+	b->key[idx] = key;
+	USKIPBLOCK_VALUE(b)[idx] = value;
+	b->n++;
+	l->size++;
+
+	return 0;
+}
+
+int uskiplist_remove(uskiplist_t *l, int64_t key)
+{
+	uskipblock_t *pos[l->max_level];
+	uskipblock_t *b, *next;
+	int64_t k0;
+	int idx;
+
+	b = _uskiplist_position(l, key, pos);
+	idx = _uskipblock_lower(b, key);
+	if (idx == b->n || b->key[idx] != key)
+		return -1;
+
+	k0 = b->key[0];
+	b->n--;
+	memmove(&b->key[idx], &b->key[idx + 1],
+			(b->n - idx) * sizeof(int64_t));
+	memmove(&USKIPBLOCK_VALUE(b)[idx], &USKIPBLOCK_VALUE(b)[idx + 1],
+			(b->n - idx) * sizeof(void *));
+	l->size--;
+
+	if (b->n == 0) {
+		_uskiplist_preds(l, k0, pos);
+		_uskiplist_unlink(l, b, pos);
+		return 0;
+	}
+
+	/* pull the next block in when both fit in 3/4 of a block */
+	next = b->forward[0];
+	if (next != NULL && b->n + next->n <= USKIPLIST_KEYS * 3 / 4) {
+		memcpy(&b->key[b->n], next->key, next->n * sizeof(int64_t));
+		memcpy(&USKIPBLOCK_VALUE(b)[b->n], USKIPBLOCK_VALUE(next),
+				next->n * sizeof(void *));
+		b->n += next->n;
+
+		_uskiplist_preds(l, next->key[0], pos);
+		_uskiplist_unlink(l, next, pos);
+	}
+
+	return 0;
+}
+
 void skiplist_mmap(skiplist_t *sl)
 {
 	int i;
@@ -289,7 +1355,7 @@ void skiplist_mmap(skiplist_t *sl)
 		printf("\tlevel %d: ", i);
 		fflush(stdout);
 		while (cur != sl->null) {
-			printf("%p(%d) ---> ", cur, cur->key);
+			printf("%p(%" PRId64 ") ---> ", cur, cur->key);
 			fflush(stdout);
 			cur = cur->forward[i];
 		}
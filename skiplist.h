@@ -6,7 +6,21 @@
 #include <stdlib.h>
 
 #define SKIPLIST_P 25
-#define SKIPNODE_SIZE(level) (sizeof(skipnode_t)+(level)*sizeof(skipnode_t *))
+
+/* p = 50 or 25 is a power of two, the level comes from a bit count */
+#if SKIPLIST_P == 50
+#define SKIPLIST_P_BITS 1
+#elif SKIPLIST_P == 25
+#define SKIPLIST_P_BITS 2
+#endif
+/*
+ * a node of level l is followed by forward[l] and then span[l],
+ * span[i] is how many level 0 steps forward[i] jumps over,
+ * the plain insert/remove keep them, the sync calls do not.
+ */
+#define SKIPNODE_SIZE(level) \
+	(sizeof(skipnode_t)+(level)*(sizeof(skipnode_t *)+sizeof(unsigned int)))
+#define SKIPNODE_SPAN(n) ((unsigned int *)&(n)->forward[(n)->level])
 
 
 struct skiplist_s;
@@ -17,10 +31,27 @@ typedef struct skipnode_s skipnode_t;
 
 typedef int        (*skiplist_cmp_func_t)(skipnode_t *x, skipnode_t *y);
 typedef void       (*skiplist_clr_func_t)(skipnode_t *x);
-typedef skipnode_t (*(*skiplist_alloc_func_t)(int size));
-typedef void               (*skiplist_free_func_t)(skipnode_t *ptr);
+typedef skipnode_t (*(*skiplist_alloc_func_t)(skiplist_t *sl, int size));
+typedef void               (*skiplist_free_func_t)(skiplist_t *sl, skipnode_t *ptr);
 typedef int                (*skiplist_random_func_t)(skiplist_t *sl);
 
+/*
+ * arena of skip nodes, nodes are cut from big chunks and a freed
+ * node goes on the free list of its level (linked by forward[0]),
+ * so a node must be freed with the level it was allocated for.
+ * skiplist_clear gives back whole chunks without touching the nodes.
+ */
+#define SKIPLIST_ARENA_CHUNK_SIZE (1 << 20)
+#define SKIPLIST_ARENA_LEVELS     64
+
+typedef struct skiplist_arena_s {
+	char *cur;
+	char *end;
+	void *chunk;	/* chunks linked by their first word */
+	long nchunk;
+	skipnode_t *free[SKIPLIST_ARENA_LEVELS];
+} skiplist_arena_t;
+
 struct skiplist_s {
 	int max_level;
 	int level;
@@ -33,31 +64,179 @@ struct skiplist_s {
 	skiplist_alloc_func_t alloc;
 	skiplist_free_func_t free;
 	skiplist_random_func_t random;
+
+	skiplist_arena_t *arena;
 };
 
+/*
+ * with the default cmp the key is a 64 bits integer compared inline,
+ * no function call per step. a list with its own cmp may use data.
+ * value is a payload the list never looks at.
+ */
 struct skipnode_s {
 	union {
-		int   key;
-		void* data;
+		int64_t key;
+		void*   data;
 	};
+	void *value;
 	int level;
 	skipnode_t *forward[0];
 };
 
 void skiplist_init(skiplist_t *sl, int max_level);
+
+/*
+ * remove all skip node, sl->clr is called on every node,
+ * with an arena the chunks are given back instead and clr is not called.
+ */
 void skiplist_clear(skiplist_t *sl); 
 void skiplist_destroy(skiplist_t *sl);
 
 skipnode_t *skiplist_find(skiplist_t *sl, skipnode_t *n);
+
+/*
+ * look up n keys at once with their searches interleaved,
+ * ret[i] is the node of keys[i] or NULL. return the number found.
+ */
+#define SKIPLIST_BATCH 16
+int         skiplist_find_batch(skiplist_t *sl, skipnode_t **keys,
+		skipnode_t **ret, int n);
 skipnode_t *skiplist_insert(skiplist_t *sl, skipnode_t *n);
 skipnode_t *skiplist_remove(skiplist_t *sl, skipnode_t *n);
 void        skiplist_mmap(skiplist_t *sl);
 
+/*
+ * remove every node between lo and hi inclusive with one search,
+ * a NULL bound is open, the bounds are search keys and not nodes
+ * of the list. the removed nodes go to sl->clr, or back to the
+ * arena when the list has one. return how many were removed.
+ */
+long        skiplist_remove_range(skiplist_t *sl, skipnode_t *lo,
+		skipnode_t *hi);
+
+/*
+ * cursor over the nodes between lo and hi inclusive, a NULL bound
+ * is open. seek searches once, next walks level 0 and returns NULL
+ * past hi. any insert or remove invalidates the cursor.
+ */
+typedef struct skiplist_cursor_s {
+	skiplist_t *sl;
+	skipnode_t *node;
+	skipnode_t *hi;
+} skiplist_cursor_t;
+
+void        skiplist_cursor_seek(skiplist_t *sl, skiplist_cursor_t *c,
+		skipnode_t *lo, skipnode_t *hi);
+skipnode_t *skiplist_cursor_next(skiplist_cursor_t *c);
+
+/*
+ * order statistics by the spans, O(log n), positions start at 0.
+ * skiplist_rank return -1 if n is not in the list,
+ * skiplist_at return NULL if idx is out of range,
+ * skiplist_range_by_rank copy up to count nodes from position start
+ * and return how many were copied.
+ */
+long        skiplist_rank(skiplist_t *sl, skipnode_t *n);
+skipnode_t *skiplist_at(skiplist_t *sl, long idx);
+long        skiplist_range_by_rank(skiplist_t *sl, long start, long count,
+		skipnode_t **nodes);
+
+/*
+ * lock free version, any number of threads may call them at the
+ * same time on a list set up by skiplist_init, never mix them with
+ * the plain insert/remove on the same list.
+ *
+ * forward pointers are linked with CAS, a removed node is first
+ * marked on the low bit of its forward pointers, top level down to
+ * level 0, the thread which marks level 0 owns the removal.
+ *
+ * a removed node is reclaimed by sl->clr once no thread can be
+ * walking it any more (epoch based), so the node returned by
+ * skiplist_sync_remove must not be freed or reused by the caller.
+ *
+ * the same goes for the node returned by skiplist_sync_find and by
+ * skiplist_sync_insert on a duplicate key: another thread may remove
+ * it and it can be reclaimed as soon as the call returns. to read it,
+ * wrap the call and the reads in skiplist_sync_enter/exit, the node
+ * then stays valid until the exit. sections nest, keep them short as
+ * they hold back the reclamation of every thread. outside a section
+ * the returned pointer is only good to compare, never dereference it.
+ *
+ * a thread which used these calls should call
+ * skiplist_sync_thread_exit before it exits, outside any section.
+ */
+#define SKIPNODE_SYNC_INSERTING (1 << 30)	/* flags in n->level */
+#define SKIPNODE_SYNC_DELETED   (1 << 29)
+#define SKIPNODE_LEVEL_MASK     0xFFFF
+
+skipnode_t *skiplist_sync_find(skiplist_t *sl, skipnode_t *n);
+skipnode_t *skiplist_sync_insert(skiplist_t *sl, skipnode_t *n);
+skipnode_t *skiplist_sync_remove(skiplist_t *sl, skipnode_t *n);
+void        skiplist_sync_enter(void);
+void        skiplist_sync_exit(void);
+void        skiplist_sync_thread_exit(void);
+
 /* overwrite these functions */
 int         skiplist_default_cmp(skipnode_t *x, skipnode_t *y);
 void        skiplist_default_clr(skipnode_t *x);
-skipnode_t *skiplist_default_alloc(int size);
-void        skiplist_default_free(skipnode_t *ptr);
+skipnode_t *skiplist_default_alloc(skiplist_t *sl, int size);
+void        skiplist_default_free(skiplist_t *sl, skipnode_t *ptr);
 int         skiplist_default_random(skiplist_t *sl);
 
+/*
+ * switch the list to arena allocation, sl->alloc/sl->free become
+ * skiplist_arena_alloc/skiplist_arena_free. the list must be empty.
+ * an arena is not thread safe, use it with the plain calls only.
+ */
+int         skiplist_arena_init(skiplist_t *sl);
+skipnode_t *skiplist_arena_alloc(skiplist_t *sl, int size);
+void        skiplist_arena_free(skiplist_t *sl, skipnode_t *ptr);
+
+/*
+ * unrolled skip list, the level 0 nodes are blocks of up to
+ * USKIPLIST_KEYS sorted keys, the upper levels link the blocks by
+ * their first key. a lookup walks the towers to a block and scans
+ * its keys, which share one cache line:
+ *
+ *  |n|level|key[USKIPLIST_KEYS]|forward[level]|value[USKIPLIST_KEYS]|
+ *
+ * a full block splits in two, a block merges with the next one
+ * when they fit in 3/4 of a block, an empty block is freed.
+ */
+#define USKIPLIST_KEYS 7
+
+struct uskipblock_s;
+typedef struct uskipblock_s uskipblock_t;
+
+struct uskipblock_s {
+	int n;
+	int level;
+	int64_t key[USKIPLIST_KEYS];
+	uskipblock_t *forward[0];
+} __attribute__((aligned(64)));
+
+#define USKIPBLOCK_VALUE(b) ((void **)&(b)->forward[(b)->level])
+#define USKIPBLOCK_SIZE(level) \
+	((sizeof(uskipblock_t) + (level) * sizeof(uskipblock_t *) \
+	  + USKIPLIST_KEYS * sizeof(void *) + 63) & ~63)
+
+typedef struct uskiplist_s {
+	int max_level;
+	int level;
+	long size;
+	long nblock;
+	uskipblock_t *head;
+} uskiplist_t;
+
+int  uskiplist_init(uskiplist_t *l, int max_level);
+void uskiplist_clear(uskiplist_t *l);
+void uskiplist_destroy(uskiplist_t *l);
+
+/* return 0 inserted, 1 the value of key was replaced, -1 no memory */
+int  uskiplist_insert(uskiplist_t *l, int64_t key, void *value);
+
+/* return 0 and the value in *value if found, -1 if not */
+int  uskiplist_find(uskiplist_t *l, int64_t key, void **value);
+int  uskiplist_remove(uskiplist_t *l, int64_t key);
+
 #endif
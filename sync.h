@@ -1,21 +1,255 @@
 #ifndef SYNC_H
 #define SYNC_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 typedef struct atomic_s {
     volatile int atomic;
 } atomic_t;
 
 /* atomic operations */
 /* add sub and or xor nand */
-#define atomic_fetch_and_op(OP, A, V) __sync_fetch_and_##OP##(&(A)->atomic, (V))
+#define atomic_fetch_and_op(OP, A, V) __sync_fetch_and_##OP(&(A)->atomic, (V))
 #define atomic_op_and_fetch(OP, A, V) __sync_##OP##_and_fetch(&(A)->atomic, (V))
 
+#define atomic_read(A)      __atomic_load_n(&(A)->atomic, __ATOMIC_RELAXED)
+#define atomic_set(A, V)    __atomic_store_n(&(A)->atomic, (V), __ATOMIC_RELAXED)
+
 /* atomic compare and set called CAS */
-#define vcas(PTR, OLDVAL, NEWVAL) __sync_val_cmp_and_set((PTR), (OLDVAL), (NEWVAL))
-#define bcas(PTR, OLDVAL, NEWVAL) __sync_bool_cmp_and_set((PTR), (OLDVAL), (NEWVAL))
+#define vcas(PTR, OLDVAL, NEWVAL) __sync_val_compare_and_swap((PTR), (OLDVAL), (NEWVAL))
+#define bcas(PTR, OLDVAL, NEWVAL) __sync_bool_compare_and_swap((PTR), (OLDVAL), (NEWVAL))
 
 /* atomic set and return */
 #define atomic_set_and_ret(PTR, VAL) __sync_lock_test_and_set((PTR), (VAL))
 #define atomic_set_zero(PTR)         __sync_lock_release((PTR))
 
+/* tell the cpu we are spinning */
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define SPIN_BACKOFF_MIN    4
+#define SPIN_BACKOFF_MAX    1024
+
+/*
+ * test and test and set spinlock.
+ * only spin on a shared read of the lock word, and back off
+ * exponentially after each failed attempt, so waiters do not
+ * keep bouncing the cache line between cores.
+ */
+typedef struct spinlock_s {
+    volatile uint32_t lock;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_init(spinlock_t *l)
+{
+    __atomic_store_n(&l->lock, 0, __ATOMIC_RELAXED);
+}
+
+static inline int spin_trylock(spinlock_t *l)
+{
+    return __atomic_load_n(&l->lock, __ATOMIC_RELAXED) == 0 &&
+        __atomic_exchange_n(&l->lock, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void spin_lock(spinlock_t *l)
+{
+    uint32_t backoff = SPIN_BACKOFF_MIN;
+    uint32_t i;
+
+    while (__atomic_exchange_n(&l->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (__atomic_load_n(&l->lock, __ATOMIC_RELAXED) != 0) {
+            for (i = 0; i < backoff; i++) {
+                cpu_relax();
+            }
+
+            if (backoff < SPIN_BACKOFF_MAX) {
+                backoff <<= 1;
+            }
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+    __atomic_store_n(&l->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * ticket lock, waiters get the lock in FIFO order.
+ * a waiter backs off in proportion to its distance from the owner.
+ */
+typedef struct ticketlock_s {
+    volatile uint32_t next;
+    volatile uint32_t owner;
+} ticketlock_t;
+
+#define TICKETLOCK_INIT { 0, 0 }
+
+static inline void ticket_init(ticketlock_t *l)
+{
+    __atomic_store_n(&l->next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->owner, 0, __ATOMIC_RELAXED);
+}
+
+static inline int ticket_trylock(ticketlock_t *l)
+{
+    uint32_t me = __atomic_load_n(&l->next, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&l->owner, __ATOMIC_RELAXED) != me) {
+        return 0;
+    }
+
+    return __atomic_compare_exchange_n(&l->next, &me, me + 1, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_lock(ticketlock_t *l)
+{
+    uint32_t me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    uint32_t owner;
+    uint32_t i;
+
+    while ((owner = __atomic_load_n(&l->owner, __ATOMIC_ACQUIRE)) != me) {
+        for (i = 0; i < (me - owner) * SPIN_BACKOFF_MIN; i++) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void ticket_unlock(ticketlock_t *l)
+{
+    /* only the owner writes owner */
+    uint32_t owner = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&l->owner, owner + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * MCS queue lock, every waiter spins on its own node,
+ * so a release only touches the cache line of the next waiter.
+ * the node must stay alive between lock and unlock, usually it
+ * lives on the stack of the caller.
+ */
+typedef struct mcs_node_s {
+    struct mcs_node_s *volatile next;
+    volatile uint32_t locked;
+} mcs_node_t;
+
+typedef struct mcslock_s {
+    mcs_node_t *volatile tail;
+} mcslock_t;
+
+#define MCSLOCK_INIT { NULL }
+
+static inline void mcs_init(mcslock_t *l)
+{
+    __atomic_store_n(&l->tail, NULL, __ATOMIC_RELAXED);
+}
+
+static inline int mcs_trylock(mcslock_t *l, mcs_node_t *me)
+{
+    mcs_node_t *expected = NULL;
+
+    me->next = NULL;
+    me->locked = 0;
+
+    return __atomic_compare_exchange_n(&l->tail, &expected, me, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void mcs_lock(mcslock_t *l, mcs_node_t *me)
+{
+    mcs_node_t *prev;
+
+    me->next = NULL;
+    me->locked = 1;
+
+    prev = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+    if (prev == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+}
+
+static inline void mcs_unlock(mcslock_t *l, mcs_node_t *me)
+{
+    mcs_node_t *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    mcs_node_t *expected;
+
+    if (next == NULL) {
+        /* no waiter, release the lock */
+        expected = me;
+        if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+
+        /* a waiter is linking itself behind us */
+        while ((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL) {
+            cpu_relax();
+        }
+    }
+
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * sequence counter, readers never block writers.
+ * the writer makes the counter odd while it is modifying the data,
+ * a reader retries when it saw an odd counter or the counter
+ * changed during its read.
+ * writers must be serialized by a lock of their own.
+ */
+typedef struct seqcount_s {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+static inline void seqcount_init(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, 0, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t read_seqbegin(const seqcount_t *s)
+{
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+
+    return seq;
+}
+
+static inline int read_seqretry(const seqcount_t *s, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqbegin(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqend(seqcount_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
 #endif // SYNC_H
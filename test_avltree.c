@@ -0,0 +1,243 @@
+#include "avltree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define AVL_TEST_MAX_THREADS 64
+
+typedef struct avlitem_s {
+    long key;
+    avlnode_t node;
+} avlitem_t;
+
+typedef struct avlarg_s {
+    int sync;       /* 1: avltree_sync_*, 0: global mutex */
+    long loops;
+    long found;
+    uint64_t seed;
+} avlarg_t;
+
+static avltree_t avl_test_tree;
+static avlitem_t *avl_test_items;
+static long avl_test_max = 1 << 20;
+static pthread_mutex_t avl_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int avlitem_cmp(avlnode_t *n1, avlnode_t *n2)
+{
+    long k1 = container_of(n1, avlitem_t, node)->key;
+    long k2 = container_of(n2, avlitem_t, node)->key;
+
+    return k1 < k2 ? -1 : k1 > k2;
+}
+
+static int avlitem_del(avlnode_t *n)
+{
+    (void)n;
+    return 0;
+}
+
+static inline uint64_t avl_xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* 95% find, 5% delete and insert back the same node */
+static void *avl_worker(void *arg)
+{
+    avlarg_t *a = arg;
+    avlitem_t tmp;
+    avlnode_t *n;
+    uint64_t r;
+    long i;
+
+    for (i = 0; i < a->loops; i++) {
+        r = avl_xorshift(&a->seed);
+        tmp.key = (r >> 8) % avl_test_max;
+
+        if ((r & 0xff) < 243) {
+            if (a->sync) {
+                n = avltree_sync_find(&avl_test_tree, &tmp.node);
+            } else {
+                pthread_mutex_lock(&avl_test_mutex);
+                n = avltree_find(&avl_test_tree, &tmp.node);
+                pthread_mutex_unlock(&avl_test_mutex);
+            }
+            a->found += (n != NULL);
+        } else if (a->sync) {
+            n = avltree_sync_delete(&avl_test_tree, &tmp.node);
+            if (n)
+                avltree_sync_insert(&avl_test_tree, n);
+        } else {
+            pthread_mutex_lock(&avl_test_mutex);
+            n = avltree_delete(&avl_test_tree, &tmp.node);
+            if (n)
+                avltree_insert(&avl_test_tree, n);
+            pthread_mutex_unlock(&avl_test_mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void avl_bench(int sync, int nthreads, long loops)
+{
+    pthread_t tid[AVL_TEST_MAX_THREADS];
+    avlarg_t arg[AVL_TEST_MAX_THREADS];
+    struct timeval stv, etv;
+    long found = 0;
+    double ms;
+    int i;
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < nthreads; i++) {
+        arg[i].sync = sync;
+        arg[i].loops = loops / nthreads;
+        arg[i].found = 0;
+        arg[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&tid[i], NULL, avl_worker, &arg[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tid[i], NULL);
+        found += arg[i].found;
+    }
+    gettimeofday(&etv, NULL);
+
+    ms = (etv.tv_sec - stv.tv_sec) * 1000.0 +
+        (etv.tv_usec - stv.tv_usec) / 1000.0 + 0.001;
+
+    printf("%-5s threads: %2d, speed: %.0lf, found: %ld\n",
+            sync ? "sync" : "mutex", nthreads,
+            loops / nthreads * nthreads / ms * 1000, found);
+}
+
+void test_avltree()
+{
+    long loops = 1 << 22;
+    int max = sysconf(_SC_NPROCESSORS_ONLN);
+    long i;
+    int n;
+
+    if (max > AVL_TEST_MAX_THREADS)
+        max = AVL_TEST_MAX_THREADS;
+
+    avltree_init(&avl_test_tree, avlitem_cmp, avlitem_del, NULL);
+    avl_test_items = calloc(avl_test_max, sizeof(avlitem_t));
+    for (i = 0; i < avl_test_max; i++) {
+        avl_test_items[i].key = i;
+        avltree_insert(&avl_test_tree, &avl_test_items[i].node);
+    }
+
+    for (n = 1; n <= max; n *= 2) {
+        avl_bench(0, n, loops);
+        avl_bench(1, n, loops);
+    }
+
+    for (i = 0; i < avl_test_max; i++) {
+        if (avltree_find(&avl_test_tree, &avl_test_items[i].node) !=
+                &avl_test_items[i].node) {
+            printf("Find %ld error\n", i);
+            break;
+        }
+    }
+
+    avltree_destroy(&avl_test_tree);
+    free(avl_test_items);
+}
+
+/* loading 4M sorted keys: insert one by one vs avltree_build_sorted */
+void test_avltree_build()
+{
+    avltree_t tree;
+    avlitem_t *items;
+    avlnode_t **sorted;
+    struct timeval stv, etv;
+    long max = 1 << 22;
+    long notok = 0;
+    long i;
+
+    items = calloc(max, sizeof(avlitem_t));
+    sorted = malloc(max * sizeof(avlnode_t *));
+    for (i = 0; i < max; i++) {
+        items[i].key = i;
+        sorted[i] = &items[i].node;
+    }
+
+    avltree_init(&tree, avlitem_cmp, avlitem_del, NULL);
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++)
+        avltree_insert(&tree, &items[i].node);
+    gettimeofday(&etv, NULL);
+    printf("insert %ld sorted: %.1lf ms, height: %u\n", max,
+            (etv.tv_sec - stv.tv_sec) * 1000.0 +
+            (etv.tv_usec - stv.tv_usec) / 1000.0, tree.root->height);
+    avltree_destroy(&tree);
+
+    avltree_init(&tree, avlitem_cmp, avlitem_del, NULL);
+    gettimeofday(&stv, NULL);
+    avltree_build_sorted(&tree, sorted, max);
+    gettimeofday(&etv, NULL);
+    printf("avltree_build_sorted %ld: %.1lf ms, height: %u\n", max,
+            (etv.tv_sec - stv.tv_sec) * 1000.0 +
+            (etv.tv_usec - stv.tv_usec) / 1000.0, tree.root->height);
+
+    for (i = 0; i < max; i += 97) {
+        if (avltree_find(&tree, &items[i].node) != &items[i].node)
+            notok++;
+    }
+    printf("find not ok: %ld, check: %d\n", notok, avltree_check(&tree));
+
+    avltree_destroy(&tree);
+    free(sorted);
+    free(items);
+}
+
+#define AVL_CHURN_KEYS  1024
+
+/* random inserts and deletes on a small tree, avltree_check after each */
+void test_avltree_check()
+{
+    avltree_t tree;
+    avlitem_t *items;
+    char *in;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    long loops = 1 << 17;
+    long size = 0, errors = 0;
+    long i, k;
+    int err = 0;
+
+    items = calloc(AVL_CHURN_KEYS, sizeof(avlitem_t));
+    in = calloc(AVL_CHURN_KEYS, 1);
+    for (k = 0; k < AVL_CHURN_KEYS; k++)
+        items[k].key = k;
+
+    avltree_init(&tree, avlitem_cmp, avlitem_del, NULL);
+    for (i = 0; i < loops && !err; i++) {
+        k = (avl_xorshift(&seed) >> 8) % AVL_CHURN_KEYS;
+        if (in[k]) {
+            errors += avltree_delete(&tree, &items[k].node) != &items[k].node;
+            size--;
+        } else {
+            errors += avltree_insert(&tree, &items[k].node) != NULL;
+            size++;
+        }
+        in[k] = !in[k];
+        err = avltree_check(&tree);
+    }
+
+    for (k = 0; k < AVL_CHURN_KEYS; k++) {
+        if ((avltree_find(&tree, &items[k].node) != NULL) != in[k])
+            errors++;
+    }
+
+    printf("avl churn loops: %ld, size: %ld, errors: %ld, check: %d\n",
+            i, size, errors, err);
+
+    avltree_destroy(&tree);
+    free(in);
+    free(items);
+}
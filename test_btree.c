@@ -0,0 +1,307 @@
+#include "btree.h"
+#include "jhash.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+static double btdtime(struct timeval *x, struct timeval *y)
+{
+    return (x->tv_sec - y->tv_sec) * 1000.0 +
+        (x->tv_usec - y->tv_usec) / 1000.0 + 0.001;
+}
+
+static int btree_height(btree_t *t)
+{
+    bnode_t *x = t->root;
+    int h = 0;
+
+    while (x) {
+        h++;
+        x = x->leaf ? NULL : x->child[0];
+    }
+
+    return h;
+}
+
+/* sweep the fanout to find the sweet spot of the hardware */
+void test_btree()
+{
+    btree_t tree;
+    struct timeval stv, etv;
+    bnode_t *retn;
+    long idx;
+    long *data;
+    int max = 1 << 22;
+    int fanout;
+    int ok, notok;
+    int i;
+
+    data = calloc(max, sizeof(long));
+    for (i = 0; i < max; i++) {
+        data[i] = ((long)hashlittle(&i, sizeof(i), 0) << 32) | i;
+    }
+
+    printf("fanout   height   insert/s   search/s   delete/s   check\n");
+    for (fanout = 4; fanout <= 256; fanout *= 2) {
+        btree_init(&tree, fanout / 2, NULL, NULL);
+
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            btree_insert(&tree, data[i], &data[i]);
+        }
+        gettimeofday(&etv, NULL);
+        printf("%6d   %6d   %8.0lf", fanout, btree_height(&tree),
+                max / btdtime(&etv, &stv) * 1000);
+
+        ok = 0;
+        notok = 0;
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            if (btree_search(&tree, data[i], &retn, &idx) == 0 &&
+                    retn->value[idx] == &data[i])
+                ok++;
+            else
+                notok++;
+        }
+        gettimeofday(&etv, NULL);
+        printf("   %8.0lf", max / btdtime(&etv, &stv) * 1000);
+
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            if (btree_delete(&tree, data[i]) != 0)
+                notok++;
+        }
+        gettimeofday(&etv, NULL);
+        printf("   %8.0lf   %s\n", max / btdtime(&etv, &stv) * 1000,
+                notok == 0 && ok == max && tree.root == NULL ? "ok" : "error");
+
+        btree_destroy(&tree);
+    }
+
+    free(data);
+}
+
+/* ordered range scans through the leaf chain of B+tree */
+void test_bptree()
+{
+    btree_t tree;
+    btree_cursor_t c;
+    struct timeval stv, etv;
+    long keys[100];
+    long k, last;
+    long total;
+    int max = 1 << 22;
+    int scans = 1 << 18;
+    int notok = 0;
+    int i, j, got;
+
+    bptree_init(&tree, 0, NULL, NULL);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        k = hashlittle(&i, sizeof(i), 0);
+        btree_insert(&tree, k, NULL);
+    }
+    gettimeofday(&etv, NULL);
+    printf("B+tree insert speed: %.0lf\n", max / btdtime(&etv, &stv) * 1000);
+
+    total = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < scans; i++) {
+        k = hashlittle(&i, sizeof(i), 1);
+        btree_cursor_seek(&tree, &c, k);
+        got = btree_cursor_fetch(&c, keys, NULL, 100);
+
+        for (j = 1; j < got; j++) {
+            if (keys[j] <= keys[j - 1])
+                notok++;
+        }
+        total += got;
+    }
+    gettimeofday(&etv, NULL);
+    printf("B+tree scan 100 by fetch: %.0lf records/s, error: %d\n",
+            total / btdtime(&etv, &stv) * 1000, notok);
+
+    total = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < scans; i++) {
+        k = hashlittle(&i, sizeof(i), 1);
+        last = -1;
+        j = 0;
+        for (btree_cursor_seek(&tree, &c, k);
+                j < 100 && btree_cursor_get(&c, &k, NULL) == 0;
+                btree_cursor_next(&c), j++) {
+            if (k <= last)
+                notok++;
+            last = k;
+        }
+        total += j;
+    }
+    gettimeofday(&etv, NULL);
+    printf("B+tree scan 100 by next: %.0lf records/s, error: %d\n",
+            total / btdtime(&etv, &stv) * 1000, notok);
+
+    btree_destroy(&tree);
+}
+
+/* node key scan: scalar vs sse4.2 vs avx2 on random 64 bits keys */
+void test_btree_search()
+{
+    static const char *name[] = { "scalar", "sse4.2", "avx2" };
+    btree_t tree;
+    struct timeval stv, etv;
+    bnode_t *retn;
+    long idx;
+    long *data;
+    uint64_t s = 88172645463325252ULL;
+    int max = 10000000;
+    int fanout, impl;
+    int notok;
+    int i;
+
+    data = calloc(max, sizeof(long));
+    for (i = 0; i < max; i++) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        data[i] = (long)s;
+    }
+
+    for (fanout = 16; fanout <= 256; fanout *= 4) {
+        btree_init(&tree, fanout / 2, NULL, NULL);
+        for (i = 0; i < max; i++) {
+            btree_insert(&tree, data[i], NULL);
+        }
+
+        for (impl = BTREE_SEARCH_SCALAR; impl <= BTREE_SEARCH_AVX2; impl++) {
+            if (btree_search_impl(impl) != impl)
+                continue;
+
+            notok = 0;
+            gettimeofday(&stv, NULL);
+            for (i = 0; i < max; i++) {
+                if (btree_search(&tree, data[i], &retn, &idx) != 0)
+                    notok++;
+            }
+            gettimeofday(&etv, NULL);
+            printf("fanout: %3d, %-6s search speed: %.0lf, not ok: %d\n",
+                    fanout, name[impl], max / btdtime(&etv, &stv) * 1000, notok);
+        }
+
+        btree_destroy(&tree);
+    }
+
+    btree_search_impl(BTREE_SEARCH_AUTO);
+    free(data);
+}
+
+/* rebuild from a sorted snapshot: btree_insert one by one vs bulk load */
+void test_btree_bulk()
+{
+    static const int fills[] = { 100, 70 };
+    btree_t tree;
+    struct timeval stv, etv;
+    bnode_t *retn;
+    long idx;
+    long *data;
+    int max = 1 << 23;
+    int plus, f;
+    int notok;
+    int i;
+
+    data = calloc(max, sizeof(long));
+    for (i = 0; i < max; i++) {
+        data[i] = (long)i * 3;
+    }
+
+    for (plus = 0; plus <= 1; plus++) {
+        if (plus)
+            bptree_init(&tree, 0, NULL, NULL);
+        else
+            btree_init(&tree, 0, NULL, NULL);
+
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            btree_insert(&tree, data[i], &data[i]);
+        }
+        gettimeofday(&etv, NULL);
+        printf("%-6s insert    : %8.1lf ms, height: %d\n",
+                plus ? "B+tree" : "btree", btdtime(&etv, &stv),
+                btree_height(&tree));
+        btree_destroy(&tree);
+
+        for (f = 0; f < 2; f++) {
+            if (plus)
+                bptree_init(&tree, 0, NULL, NULL);
+            else
+                btree_init(&tree, 0, NULL, NULL);
+
+            gettimeofday(&stv, NULL);
+            btree_bulk_load(&tree, data, NULL, max, fills[f]);
+            gettimeofday(&etv, NULL);
+
+            notok = 0;
+            for (i = 0; i < max; i++) {
+                if (btree_search(&tree, data[i], &retn, &idx) != 0)
+                    notok++;
+            }
+            printf("%-6s bulk %3d%%: %8.1lf ms, height: %d, not ok: %d\n",
+                    plus ? "B+tree" : "btree", fills[f], btdtime(&etv, &stv),
+                    btree_height(&tree), notok);
+            btree_destroy(&tree);
+        }
+    }
+
+    free(data);
+}
+
+/* node pool: build, clear and rebuild, destroy, with and without huge pages */
+void test_btree_pool()
+{
+    btree_t tree;
+    struct timeval stv, etv;
+    long *data;
+    int max = 1 << 22;
+    int huge;
+    int i;
+
+    data = calloc(max, sizeof(long));
+    for (i = 0; i < max; i++) {
+        data[i] = ((long)hashlittle(&i, sizeof(i), 0) << 32) | i;
+    }
+
+    for (huge = 0; huge <= 1; huge++) {
+        btree_init(&tree, 0, NULL, NULL);
+        btree_set_hugepage(&tree, huge);
+
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            btree_insert(&tree, data[i], &data[i]);
+        }
+        gettimeofday(&etv, NULL);
+        printf("hugepage: %d, insert speed: %.0lf, chunks: %ld + %ld\n", huge,
+                max / btdtime(&etv, &stv) * 1000,
+                tree.pool[0].nchunk, tree.pool[1].nchunk);
+
+        gettimeofday(&stv, NULL);
+        btree_clear(&tree);
+        gettimeofday(&etv, NULL);
+        printf("hugepage: %d, clear: %.3lf ms\n", huge, btdtime(&etv, &stv));
+
+        /* the second build reuses the chunks of the first */
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < max; i++) {
+            btree_insert(&tree, data[i], &data[i]);
+        }
+        gettimeofday(&etv, NULL);
+        printf("hugepage: %d, insert again speed: %.0lf, chunks: %ld + %ld\n",
+                huge, max / btdtime(&etv, &stv) * 1000,
+                tree.pool[0].nchunk, tree.pool[1].nchunk);
+
+        gettimeofday(&stv, NULL);
+        btree_destroy(&tree);
+        gettimeofday(&etv, NULL);
+        printf("hugepage: %d, destroy: %.3lf ms\n", huge, btdtime(&etv, &stv));
+    }
+
+    free(data);
+}
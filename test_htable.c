@@ -0,0 +1,183 @@
+#include "htable.h"
+#include "rbt.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+typedef struct hitem_s {
+    long key;
+    htnode_t hnode;
+    rbt_node_t rnode;
+} hitem_t;
+
+static const void *hitem_key(htnode_t *n, size_t *len)
+{
+    hitem_t *item = container_of(n, hitem_t, hnode);
+
+    *len = sizeof(item->key);
+    return &item->key;
+}
+
+static int hitem_cmp(htnode_t *x, htnode_t *y)
+{
+    return container_of(x, hitem_t, hnode)->key !=
+        container_of(y, hitem_t, hnode)->key;
+}
+
+static unsigned int htdtime(struct timeval *x, struct timeval *y)
+{
+    return (x->tv_sec * 1000 + x->tv_usec / 1000)
+        - (y->tv_sec * 1000 + y->tv_usec / 1000) + 1;
+}
+
+void test_htable()
+{
+    htable_t ht;
+    rbt_tree_t rbt;
+    hitem_t *items, tmp;
+    struct timeval stv, etv;
+    int max = 1 << 21;
+    int ok, notok;
+    uint32_t buckets;
+    unsigned int hms, rms;
+    int i, j;
+
+    items = calloc(max, sizeof(hitem_t));
+    htable_init(&ht, 0, hitem_key, hitem_cmp, NULL);
+    rbt_init(&rbt, rbt_cmp_func, NULL, NULL, NULL);
+
+    for (i = 0; i < max; i++) {
+        items[i].key = i;
+        items[i].rnode.key = i;
+    }
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        if (htable_insert(&ht, &items[i].hnode) != NULL) {
+            printf("Insert %d error\n", i);
+        }
+    }
+    gettimeofday(&etv, NULL);
+    printf("htable insert speed: %u\n", max / htdtime(&etv, &stv) * 1000);
+
+    for (i = 0; i < max; i++) {
+        rbt_insert(&rbt, &items[i].rnode);
+    }
+
+    ok = 0;
+    notok = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        tmp.key = i;
+        if (htable_find(&ht, &tmp.hnode) == &items[i].hnode)
+            ok++;
+        else
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    printf("htable find speed: %u, ok: %d, not ok: %d\n",
+            max / htdtime(&etv, &stv) * 1000, ok, notok);
+
+    ok = 0;
+    notok = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        tmp.rnode.key = i;
+        if (rbt_find(&rbt, &tmp.rnode) == &items[i].rnode)
+            ok++;
+        else
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    printf("rbt find speed: %u, ok: %d, not ok: %d\n",
+            max / htdtime(&etv, &stv) * 1000, ok, notok);
+
+    /* delete the odd keys, the load only drops to about 50% */
+    ok = 0;
+    notok = 0;
+    for (i = 1; i < max; i += 2) {
+        tmp.key = i;
+        if (htable_delete(&ht, &tmp.hnode) == &items[i].hnode)
+            ok++;
+        else
+            notok++;
+    }
+
+    for (i = 0; i < max; i++) {
+        tmp.key = i;
+        if ((htable_find(&ht, &tmp.hnode) != NULL) != !(i & 1))
+            notok++;
+    }
+    printf("htable delete ok: %d, not ok: %d, size: %u\n",
+            ok, notok, htable_size(&ht));
+
+    /* keep one key in 16, below HTABLE_MIN_LOAD the table shrinks */
+    buckets = ht.ht[0].size;
+    ok = 0;
+    notok = 0;
+    for (i = 0; i < max; i += 2) {
+        if (i % 16 == 0)
+            continue;
+        tmp.key = i;
+        if (htable_delete(&ht, &tmp.hnode) == &items[i].hnode)
+            ok++;
+        else
+            notok++;
+    }
+
+    /* the finds also finish the incremental rehash */
+    for (i = 0; i < max; i++) {
+        tmp.key = i;
+        if ((htable_find(&ht, &tmp.hnode) != NULL) != (i % 16 == 0))
+            notok++;
+    }
+    if (htable_is_rehashing(&ht) || ht.ht[0].size >= buckets)
+        notok++;
+    printf("htable shrink ok: %d, not ok: %d, size: %u, buckets: %u -> %u\n",
+            ok, notok, htable_size(&ht), buckets, ht.ht[0].size);
+
+    /*
+     * random keys looked up in random order, into a table sized up front
+     * so no rehash step runs during the finds, against the same rbt.
+     */
+    htable_destroy(&ht);
+    htable_init(&ht, max, hitem_key, hitem_cmp, NULL);
+    rbt_init(&rbt, rbt_cmp_func, NULL, NULL, NULL);
+    for (i = 0; i < max; i++) {
+        items[i].key = (i * 2654435761UL) & 0x7fffffff;
+        items[i].rnode.key = items[i].key;
+        htable_insert(&ht, &items[i].hnode);
+        rbt_insert(&rbt, &items[i].rnode);
+    }
+
+    ok = 0;
+    notok = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        j = ((unsigned int)i * 40503) & (max - 1);
+        tmp.key = items[j].key;
+        if (htable_find(&ht, &tmp.hnode) == &items[j].hnode)
+            ok++;
+        else
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    hms = htdtime(&etv, &stv);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        j = ((unsigned int)i * 40503) & (max - 1);
+        tmp.rnode.key = items[j].key;
+        if (rbt_find(&rbt, &tmp.rnode) == &items[j].rnode)
+            ok++;
+        else
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    rms = htdtime(&etv, &stv);
+
+    printf("random find htable: %u, rbt: %u, ratio: %.2f, ok: %d, not ok: %d\n",
+            max / hms * 1000, max / rms * 1000, (double)rms / hms, ok, notok);
+
+    htable_destroy(&ht);
+    free(items);
+}
@@ -0,0 +1,219 @@
+#include "memtable.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define MT_TEST_WAL     "memtable_test.wal"
+#define MT_TEST_FILE    "memtable_test.sst"
+#define MT_TEST_VALUE   100
+#define MT_TEST_THREADS 16
+#define MT_TEST_RECOVER 1000
+
+typedef struct mtarg_s {
+    memtable_t *m;
+    long base;
+    long count;
+} mtarg_t;
+
+static double mtdtime(struct timeval *x, struct timeval *y)
+{
+    return (x->tv_sec - y->tv_sec) * 1000.0 +
+        (x->tv_usec - y->tv_usec) / 1000.0 + 0.001;
+}
+
+static void *mt_writer(void *arg)
+{
+    mtarg_t *a = arg;
+    char value[MT_TEST_VALUE];
+    long i;
+
+    memset(value, 'v', sizeof(value));
+    for (i = 0; i < a->count; i++) {
+        memtable_put(a->m, a->base + i, value, sizeof(value));
+    }
+
+    return NULL;
+}
+
+static void mt_bench(int sync, int nthreads, long count)
+{
+    static const char *name[] = { "none", "each", "group" };
+    pthread_t tid[MT_TEST_THREADS];
+    mtarg_t arg[MT_TEST_THREADS];
+    struct timeval stv, etv;
+    memtable_t m;
+    int i;
+
+    unlink(MT_TEST_WAL);
+    if (memtable_open(&m, MT_TEST_WAL, sync) != 0) {
+        printf("open %s error\n", MT_TEST_WAL);
+        return;
+    }
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < nthreads; i++) {
+        arg[i].m = &m;
+        arg[i].base = (long)i << 32;
+        arg[i].count = count / nthreads;
+        pthread_create(&tid[i], NULL, mt_writer, &arg[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    gettimeofday(&etv, NULL);
+
+    printf("sync: %-5s threads: %2d, writes/s: %8.0lf, fdatasync: %ld\n",
+            name[sync], nthreads,
+            count / nthreads * nthreads / mtdtime(&etv, &stv) * 1000, m.nsync);
+
+    memtable_close(&m);
+    unlink(MT_TEST_WAL);
+}
+
+/* the value of key in version ver, 1 to 64 bytes */
+static uint32_t mt_value(long key, int ver, char *value)
+{
+    uint32_t len = 1 + (key * 7 + ver) % 64;
+
+    memset(value, 'a' + ver, len);
+
+    return len;
+}
+
+/* count the keys in [0, max) whose value is not the version in ver[] */
+static long mt_recover_errors(memtable_t *m, long max, int *ver)
+{
+    char expect[64];
+    const void *value;
+    uint32_t len;
+    long i, errors = 0;
+
+    for (i = 0; i < max; i++) {
+        if (memtable_get(m, i, &value, &len) != 0) {
+            errors += ver[i] != 0;
+            continue;
+        }
+        if (ver[i] == 0 || len != mt_value(i, ver[i], expect) ||
+                memcmp(value, expect, len) != 0)
+            errors++;
+    }
+
+    return errors;
+}
+
+/*
+ * put and overwrite, cut the log inside its last record and reopen:
+ * every complete record is back with its last value, the torn one is
+ * gone, and the puts after the reopen survive the next one.
+ */
+void test_memtable_recover()
+{
+    static int ver[MT_TEST_RECOVER + 1];
+    memtable_t m;
+    struct stat st;
+    char value[64];
+    uint32_t len;
+    long i, errors = 0;
+
+    unlink(MT_TEST_WAL);
+    memset(ver, 0, sizeof(ver));
+    memtable_open(&m, MT_TEST_WAL, MEMTABLE_SYNC_NONE);
+    for (i = 0; i < MT_TEST_RECOVER; i++) {
+        len = mt_value(i, 1, value);
+        memtable_put(&m, i, value, len);
+        ver[i] = 1;
+    }
+    for (i = 0; i < MT_TEST_RECOVER; i += 3) {
+        len = mt_value(i, 2, value);
+        memtable_put(&m, i, value, len);
+        ver[i] = 2;
+    }
+    /* the torn record, a new key */
+    len = mt_value(MT_TEST_RECOVER, 1, value);
+    memtable_put(&m, MT_TEST_RECOVER, value, len);
+    memtable_close(&m);
+
+    stat(MT_TEST_WAL, &st);
+    if (truncate(MT_TEST_WAL, st.st_size - 3) != 0 ||
+            memtable_open(&m, MT_TEST_WAL, MEMTABLE_SYNC_NONE) != 0) {
+        printf("reopen %s error\n", MT_TEST_WAL);
+        return;
+    }
+    errors += mt_recover_errors(&m, MT_TEST_RECOVER + 1, ver);
+
+    for (i = 1; i < MT_TEST_RECOVER; i += 5) {
+        len = mt_value(i, 3, value);
+        memtable_put(&m, i, value, len);
+        ver[i] = 3;
+    }
+    len = mt_value(MT_TEST_RECOVER, 3, value);
+    memtable_put(&m, MT_TEST_RECOVER, value, len);
+    ver[MT_TEST_RECOVER] = 3;
+    memtable_close(&m);
+
+    if (memtable_open(&m, MT_TEST_WAL, MEMTABLE_SYNC_NONE) != 0) {
+        printf("reopen %s error\n", MT_TEST_WAL);
+        return;
+    }
+    errors += mt_recover_errors(&m, MT_TEST_RECOVER + 1, ver);
+    memtable_close(&m);
+    unlink(MT_TEST_WAL);
+
+    printf("recover records: %d, errors: %ld, check: %s\n",
+            MT_TEST_RECOVER, errors, errors ? "error" : "ok");
+}
+
+/* sustained writes with and without fsync batching, then flush and read */
+void test_memtable()
+{
+    struct timeval stv, etv;
+    memtable_t m;
+    memtable_file_t f;
+    char value[MT_TEST_VALUE];
+    long max = 1 << 20;
+    long loops = 1 << 18;
+    long i, notok;
+    int n;
+
+    mt_bench(MEMTABLE_SYNC_NONE, 1, max);
+    for (n = 1; n <= MT_TEST_THREADS; n *= 4) {
+        mt_bench(MEMTABLE_SYNC_EACH, n, 1 << 10);
+        mt_bench(MEMTABLE_SYNC_GROUP, n, 1 << 10);
+    }
+
+    unlink(MT_TEST_WAL);
+    memtable_open(&m, MT_TEST_WAL, MEMTABLE_SYNC_NONE);
+    memset(value, 'v', sizeof(value));
+    for (i = 0; i < max; i++) {
+        memtable_put(&m, (i * 2654435761L) % max, value, sizeof(value));
+    }
+
+    gettimeofday(&stv, NULL);
+    memtable_flush(&m, MT_TEST_FILE);
+    gettimeofday(&etv, NULL);
+    printf("flush %ld records: %.1lf ms\n", max, mtdtime(&etv, &stv));
+    memtable_close(&m);
+    unlink(MT_TEST_WAL);
+
+    if (memtable_file_open(&f, MT_TEST_FILE) != 0) {
+        printf("open %s error\n", MT_TEST_FILE);
+        return;
+    }
+
+    notok = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < loops; i++) {
+        if (memtable_file_get(&f, (i * 40503) % max, value,
+                    sizeof(value)) != MT_TEST_VALUE)
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    printf("file get speed: %.0lf, index: %ld, not ok: %ld\n",
+            loops / mtdtime(&etv, &stv) * 1000, f.nindex, notok);
+
+    memtable_file_close(&f);
+    unlink(MT_TEST_FILE);
+}
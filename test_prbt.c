@@ -0,0 +1,284 @@
+#include "prbt.h"
+#include "rbt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define PRBT_TEST_KEYS      (1 << 20)
+#define PRBT_TEST_READERS   4
+#define PRBT_TEST_VIEW      64      /* finds on one point in time view */
+#define PRBT_TEST_MS        1000
+
+typedef struct prbtarg_s {
+    int persistent;     /* 1: prbt snapshots, 0: rbt with a rwlock */
+    int check;          /* count every snapshot before and after the finds */
+    long ops;
+    long errors;
+    long found;
+    uint64_t seed;
+} prbtarg_t;
+
+static prbt_t prbt_test_tree;
+static rbt_tree_t prbt_test_rbt;
+static pthread_rwlock_t prbt_test_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static int prbt_test_stop;
+
+static inline uint64_t prbt_xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void prbt_rbt_set(long key, int insert)
+{
+    rbt_node_t tmp, *n;
+
+    tmp.key = key;
+    n = rbt_find(&prbt_test_rbt, &tmp);
+    if (insert) {
+        if (n != rbt_end(&prbt_test_rbt)) {
+            n->layer = key;
+            return;
+        }
+        n = calloc(1, sizeof(rbt_node_t));
+        n->key = key;
+        n->layer = key;
+        rbt_insert(&prbt_test_rbt, n);
+    } else if (n != rbt_end(&prbt_test_rbt)) {
+        rbt_delete(&prbt_test_rbt, n);
+        free(n);
+    }
+}
+
+/* half inserts, half deletes of random keys */
+static void *prbt_writer(void *arg)
+{
+    prbtarg_t *a = arg;
+    uint64_t r;
+    long key;
+
+    while (!__atomic_load_n(&prbt_test_stop, __ATOMIC_RELAXED)) {
+        r = prbt_xorshift(&a->seed);
+        key = (r >> 8) % PRBT_TEST_KEYS;
+
+        if (a->persistent) {
+            if (r & 1)
+                prbt_insert(&prbt_test_tree, key, (void *)key);
+            else
+                prbt_delete(&prbt_test_tree, key);
+        } else {
+            pthread_rwlock_wrlock(&prbt_test_rwlock);
+            prbt_rbt_set(key, r & 1);
+            pthread_rwlock_unlock(&prbt_test_rwlock);
+        }
+        a->ops++;
+    }
+
+    return NULL;
+}
+
+/* every view is read PRBT_TEST_VIEW times while it must not change */
+static void *prbt_reader(void *arg)
+{
+    prbtarg_t *a = arg;
+    prbt_snap_t s;
+    rbt_node_t tmp;
+    int i;
+
+    while (!__atomic_load_n(&prbt_test_stop, __ATOMIC_RELAXED)) {
+        if (a->persistent) {
+            prbt_snapshot(&prbt_test_tree, &s);
+            if (a->check && prbt_range(&s, 0, PRBT_TEST_KEYS, NULL, NULL)
+                    != (long)s.size)
+                a->errors++;
+            for (i = 0; i < PRBT_TEST_VIEW; i++) {
+                tmp.key = prbt_xorshift(&a->seed) % PRBT_TEST_KEYS;
+                a->found += prbt_find(&s, tmp.key) != NULL;
+            }
+            if (a->check && prbt_range(&s, 0, PRBT_TEST_KEYS, NULL, NULL)
+                    != (long)s.size)
+                a->errors++;
+            prbt_release(&prbt_test_tree, &s);
+        } else {
+            pthread_rwlock_rdlock(&prbt_test_rwlock);
+            for (i = 0; i < PRBT_TEST_VIEW; i++) {
+                tmp.key = prbt_xorshift(&a->seed) % PRBT_TEST_KEYS;
+                a->found += rbt_find(&prbt_test_rbt, &tmp) !=
+                    rbt_end(&prbt_test_rbt);
+            }
+            pthread_rwlock_unlock(&prbt_test_rwlock);
+        }
+        a->ops += PRBT_TEST_VIEW;
+    }
+
+    return NULL;
+}
+
+/*
+ * with check the readers walk every snapshot twice, that is no longer a
+ * bench of the finds, only the errors are meaningful then.
+ */
+static void prbt_bench(int persistent, int check)
+{
+    pthread_t tid[PRBT_TEST_READERS + 1];
+    prbtarg_t arg[PRBT_TEST_READERS + 1];
+    struct timeval stv, etv;
+    long reads = 0, errors = 0;
+    double ms;
+    int i;
+
+    __atomic_store_n(&prbt_test_stop, 0, __ATOMIC_RELAXED);
+    gettimeofday(&stv, NULL);
+    for (i = 0; i <= PRBT_TEST_READERS; i++) {
+        arg[i].persistent = persistent;
+        arg[i].check = check;
+        arg[i].ops = 0;
+        arg[i].errors = 0;
+        arg[i].found = 0;
+        arg[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_create(&tid[i], NULL, i ? prbt_reader : prbt_writer, &arg[i]);
+    }
+
+    usleep(PRBT_TEST_MS * 1000);
+    __atomic_store_n(&prbt_test_stop, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i <= PRBT_TEST_READERS; i++) {
+        pthread_join(tid[i], NULL);
+        if (i) {
+            reads += arg[i].ops;
+            errors += arg[i].errors;
+        }
+    }
+    gettimeofday(&etv, NULL);
+
+    ms = (etv.tv_sec - stv.tv_sec) * 1000.0 +
+        (etv.tv_usec - stv.tv_usec) / 1000.0;
+
+    if (check) {
+        printf("prbt snapshots counted: %ld, check: %s\n",
+                reads / PRBT_TEST_VIEW, errors ? "error" : "ok");
+        return;
+    }
+
+    printf("%-6s readers: %d, reads/s: %.0lf, writes/s: %.0lf\n",
+            persistent ? "prbt" : "rwlock", PRBT_TEST_READERS,
+            reads / ms * 1000, arg[0].ops / ms * 1000);
+}
+
+#define PRBT_SNAP_KEYS      1000
+
+typedef struct prbtsnap_arg_s {
+    long prev;
+    long shift;         /* value - key expected */
+    long errors;
+} prbtsnap_arg_t;
+
+static int prbt_snap_visit(prbt_node_t *n, void *arg)
+{
+    prbtsnap_arg_t *a = arg;
+
+    if (n->key <= a->prev || (long)n->value != n->key + a->shift)
+        a->errors++;
+    a->prev = n->key;
+
+    return 0;
+}
+
+/* the contents of the snapshot s, keys in [lo, hi) with value key + shift */
+static long prbt_snap_errors(prbt_snap_t *s, long lo, long hi, long shift)
+{
+    prbtsnap_arg_t a = { -1, shift, 0 };
+    prbt_node_t *n;
+    long key;
+
+    for (key = 0; key < 2 * PRBT_SNAP_KEYS; key++) {
+        n = prbt_find(s, key);
+        if ((key >= lo && key < hi) != (n != NULL))
+            a.errors++;
+    }
+
+    if (prbt_range(s, lo, hi - 1, prbt_snap_visit, &a) != hi - lo)
+        a.errors++;
+    if (prbt_range(s, 0, 2 * PRBT_SNAP_KEYS, NULL, NULL) != (long)s->size ||
+            s->size != (unsigned long)(hi - lo) || prbt_check(s))
+        a.errors++;
+
+    return a.errors;
+}
+
+/*
+ * an old snapshot keeps its contents and size through inserts, deletes
+ * and overwrites, a new one sees them, and releasing the old one gives
+ * back the nodes only it held.
+ */
+void test_prbt_snapshot()
+{
+    prbt_t t;
+    prbt_snap_t old, cur;
+    long key, errors = 0;
+    int live;
+
+    prbt_init(&t);
+    for (key = 0; key < PRBT_SNAP_KEYS; key++)
+        prbt_insert(&t, key, (void *)key);
+
+    prbt_snapshot(&t, &old);
+    live = atomic_read(&t.nodes);
+
+    /* shift the keys by 100 and the values by 1 */
+    for (key = 0; key < 100; key++)
+        errors += prbt_delete(&t, key) != 0;
+    for (key = PRBT_SNAP_KEYS; key < PRBT_SNAP_KEYS + 100; key++)
+        errors += prbt_insert(&t, key, (void *)(key + 1)) != 0;
+    for (key = 100; key < PRBT_SNAP_KEYS; key++)
+        errors += prbt_insert(&t, key, (void *)(key + 1)) != 1;
+
+    errors += prbt_snap_errors(&old, 0, PRBT_SNAP_KEYS, 0);
+
+    prbt_snapshot(&t, &cur);
+    errors += prbt_snap_errors(&cur, 100, PRBT_SNAP_KEYS + 100, 1);
+
+    prbt_release(&t, &old);
+    errors += atomic_read(&t.nodes) != live;
+    errors += prbt_snap_errors(&cur, 100, PRBT_SNAP_KEYS + 100, 1);
+    prbt_release(&t, &cur);
+    errors += atomic_read(&t.nodes) != live;
+
+    prbt_destroy(&t);
+    errors += atomic_read(&t.nodes) != 0;
+
+    printf("prbt snapshot errors: %ld, check: %s\n", errors,
+            errors ? "error" : "ok");
+}
+
+/* one writer and snapshot readers vs the same load on a rwlock rbt */
+void test_prbt()
+{
+    prbt_snap_t s;
+    long i, key;
+
+    prbt_init(&prbt_test_tree);
+    rbt_init(&prbt_test_rbt, rbt_cmp_func, free, NULL, NULL);
+    for (i = 0; i < PRBT_TEST_KEYS / 2; i++) {
+        key = (i * 2654435761L) % PRBT_TEST_KEYS;
+        prbt_insert(&prbt_test_tree, key, (void *)key);
+        prbt_rbt_set(key, 1);
+    }
+
+    prbt_bench(0, 0);
+    prbt_bench(1, 0);
+    prbt_bench(1, 1);
+
+    prbt_snapshot(&prbt_test_tree, &s);
+    printf("size: %lu, nodes: %d, check: %d\n", s.size,
+            atomic_read(&prbt_test_tree.nodes), prbt_check(&s));
+    prbt_release(&prbt_test_tree, &s);
+
+    prbt_destroy(&prbt_test_tree);
+    rbt_destroy(&prbt_test_rbt);
+    printf("nodes after destroy: %d\n", atomic_read(&prbt_test_tree.nodes));
+}
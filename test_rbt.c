@@ -1,4 +1,6 @@
 #include "rbt.h"
+#include "jhash.h"
+#include <sys/time.h>
 
 
 
@@ -59,3 +61,299 @@ void test_rbt()
     rbt_destroy(&rbt);
 }
 
+
+static double rbtdtime(struct timeval *x, struct timeval *y)
+{
+    return (x->tv_sec - y->tv_sec) * 1000.0 +
+        (x->tv_usec - y->tv_usec) / 1000.0 + 0.001;
+}
+
+/* percentiles over a sliding window: order statistics vs a linear scan */
+void test_rbt_rank()
+{
+    rbt_tree_t rbt;
+    rbt_node_t *nodes, *n;
+    rbt_node_t lo, hi;
+    struct timeval stv, etv;
+    long window = 1 << 20;
+    long samples = 1 << 22;
+    long queries = 0, scans = 0;
+    unsigned long p50 = 0, p99 = 0, count = 0;
+    long notok = 0;
+    long i, j;
+
+    rbt_init(&rbt, rbt_cmp_func, NULL, NULL, NULL);
+    nodes = calloc(window, sizeof(rbt_node_t));
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < samples; i++) {
+        /* the oldest sample leaves the window, its node is reused */
+        n = &nodes[i % window];
+        if (i >= window)
+            rbt_delete(&rbt, n);
+        n->key = hashlittle(&i, sizeof(i), 0) % 1000000;
+        rbt_insert(&rbt, n);
+
+        if (i >= window && (i & 1023) == 0) {
+            p50 = rbt_select(&rbt, rbt.size / 2)->key;
+            p99 = rbt_select(&rbt, rbt.size * 99 / 100)->key;
+            lo.key = p50;
+            hi.key = p99;
+            count += rbt_count_range(&rbt, &lo, &hi);
+            if (rbt_rank(&rbt, rbt_select(&rbt, i % rbt.size)) != i % rbt.size)
+                notok++;
+            queries++;
+        }
+    }
+    gettimeofday(&etv, NULL);
+    printf("window: %ld, samples/s: %.0lf, queries: %ld, p50: %lu, p99: %lu,"
+            " not ok: %ld\n", window, samples / rbtdtime(&etv, &stv) * 1000,
+            queries, p50, p99, notok);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < queries; i++)
+        count -= rbt_count_range(&rbt, &lo, &hi);
+    gettimeofday(&etv, NULL);
+    printf("rbt_count_range speed: %.0lf\n", queries / rbtdtime(&etv, &stv) * 1000);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < window; j++) {
+            if (nodes[j].key >= lo.key && nodes[j].key <= hi.key)
+                scans++;
+        }
+    }
+    gettimeofday(&etv, NULL);
+    printf("linear count speed: %.0lf, check: %s\n",
+            16 / rbtdtime(&etv, &stv) * 1000,
+            (unsigned long)scans / 16 == rbt_count_range(&rbt, &lo, &hi) ?
+            "ok" : "error");
+
+    free(nodes);
+}
+
+/* stabbing and overlap queries on 1M intervals vs a linear scan */
+void test_rbt_interval()
+{
+    rbt_tree_t rbt;
+    rbt_node_t *nodes;
+    struct timeval stv, etv;
+    long max = 1 << 20;
+    long queries = 1 << 18;
+    long scans = 64;
+    long found, lo, hi;
+    long notok = 0;
+    long i, j, n;
+    uint32_t h;
+
+    rbt_interval_init(&rbt, NULL);
+    nodes = calloc(max, sizeof(rbt_node_t));
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++) {
+        h = hashlittle(&i, sizeof(i), 0);
+        nodes[i].key = h >> 2;
+        nodes[i].end = nodes[i].key + 1 + hashlittle(&i, sizeof(i), 1) % 65536;
+        rbt_insert(&rbt, &nodes[i]);
+    }
+    gettimeofday(&etv, NULL);
+    printf("interval insert speed: %.0lf\n", max / rbtdtime(&etv, &stv) * 1000);
+
+    found = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < queries; i++) {
+        lo = hashlittle(&i, sizeof(i), 2) >> 2;
+        found += rbt_stab(&rbt, lo, NULL, NULL);
+    }
+    gettimeofday(&etv, NULL);
+    printf("rbt_stab speed: %.0lf, found: %ld\n",
+            queries / rbtdtime(&etv, &stv) * 1000, found);
+
+    found = 0;
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < queries; i++) {
+        lo = hashlittle(&i, sizeof(i), 3) >> 2;
+        found += rbt_overlap(&rbt, lo, lo + 4096, NULL, NULL);
+    }
+    gettimeofday(&etv, NULL);
+    printf("rbt_overlap 4096 speed: %.0lf, found: %ld\n",
+            queries / rbtdtime(&etv, &stv) * 1000, found);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < scans; i++) {
+        lo = hashlittle(&i, sizeof(i), 3) >> 2;
+        hi = lo + 4096;
+        n = 0;
+        for (j = 0; j < max; j++) {
+            if (nodes[j].key < hi && nodes[j].end > lo)
+                n++;
+        }
+        if (n != rbt_overlap(&rbt, lo, hi, NULL, NULL))
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    printf("linear overlap speed: %.0lf, not ok: %ld\n",
+            scans / rbtdtime(&etv, &stv) * 1000, notok);
+
+    /*
+     * churn a small tree, max must survive the rotations of insert
+     * and of the delete fixup, the queries must match a linear scan.
+     */
+    rbt_interval_init(&rbt, NULL);
+    n = 4096;
+    for (i = 0; i < n; i++) {
+        nodes[i].key = hashlittle(&i, sizeof(i), 4) % 100000;
+        nodes[i].end = nodes[i].key + 1 + hashlittle(&i, sizeof(i), 5) % 2000;
+        nodes[i].layer = 0;     /* 1 while in the tree */
+    }
+
+    notok = 0;
+    for (i = 0; i < (1 << 15); i++) {
+        h = hashlittle(&i, sizeof(i), 6);
+        j = h % n;
+        if (nodes[j].layer) {
+            rbt_delete(&rbt, &nodes[j]);
+            nodes[j].layer = 0;
+        } else {
+            nodes[j].end = nodes[j].key + 1 + (h >> 12) % 2000;
+            rbt_insert(&rbt, &nodes[j]);
+            nodes[j].layer = 1;
+        }
+        if (rbt_check(&rbt) != 0)
+            notok++;
+
+        if ((i & 63) == 0) {
+            lo = (h >> 8) % 100000;
+            hi = lo + (h >> 24) % 500;
+            found = 0;
+            for (j = 0; j < n; j++) {
+                if (nodes[j].layer && nodes[j].key < hi && nodes[j].end > lo)
+                    found++;
+            }
+            if (found != rbt_overlap(&rbt, lo, hi, NULL, NULL) ||
+                    (found != 0) != (rbt_overlap_any(&rbt, lo, hi) !=
+                        rbt_end(&rbt)))
+                notok++;
+
+            found = 0;
+            for (j = 0; j < n; j++) {
+                if (nodes[j].layer && nodes[j].key <= lo && nodes[j].end > lo)
+                    found++;
+            }
+            if (found != rbt_stab(&rbt, lo, NULL, NULL))
+                notok++;
+        }
+    }
+    printf("interval churn: size: %lu, check: %d, not ok: %ld\n",
+            rbt.size, rbt_check(&rbt), notok);
+
+    free(nodes);
+}
+
+/* loading 4M sorted keys: insert one by one vs rbt_build_sorted */
+void test_rbt_build()
+{
+    rbt_tree_t rbt;
+    rbt_node_t *nodes, **sorted;
+    struct timeval stv, etv;
+    long max = 1 << 22;
+    long i;
+
+    nodes = calloc(max, sizeof(rbt_node_t));
+    sorted = malloc(max * sizeof(rbt_node_t *));
+    for (i = 0; i < max; i++) {
+        nodes[i].key = i;
+        sorted[i] = &nodes[i];
+    }
+
+    rbt_init(&rbt, rbt_cmp_func, NULL, NULL, NULL);
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < max; i++)
+        rbt_insert(&rbt, &nodes[i]);
+    gettimeofday(&etv, NULL);
+    printf("insert %ld sorted: %.1lf ms, check: %d\n",
+            max, rbtdtime(&etv, &stv), rbt_check(&rbt));
+
+    rbt_init(&rbt, rbt_cmp_func, NULL, NULL, NULL);
+    gettimeofday(&stv, NULL);
+    rbt_build_sorted(&rbt, sorted, max);
+    gettimeofday(&etv, NULL);
+    printf("rbt_build_sorted %ld: %.1lf ms, check: %d\n",
+            max, rbtdtime(&etv, &stv), rbt_check(&rbt));
+
+    free(sorted);
+    free(nodes);
+}
+
+static long rbt_test_visited;
+
+static int rbt_count_travel(rbt_tree_t *t, rbt_node_t *prev, rbt_node_t *curr)
+{
+    (void)t;
+    (void)prev;
+    (void)curr;
+    rbt_test_visited++;
+    return 0;
+}
+
+/* walks, seeks and teardown of 4M nodes without recursion */
+void test_rbt_cursor()
+{
+    rbt_tree_t rbt;
+    rbt_cursor_t c;
+    rbt_node_t *n, tmp;
+    struct timeval stv, etv;
+    long max = 1 << 22;
+    long seeks = 1 << 20;
+    long count, notok = 0;
+    long i;
+
+    /* 31 bit keys, rbt_cmp_func returns the difference as an int */
+    rbt_init(&rbt, rbt_cmp_func, free, rbt_count_travel, NULL);
+    for (i = 0; i < max; i++) {
+        n = calloc(1, sizeof(rbt_node_t));
+        n->key = hashlittle(&i, sizeof(i), 0) & 0x7fffffff;
+        rbt_insert(&rbt, n);
+    }
+
+    rbt_test_visited = 0;
+    gettimeofday(&stv, NULL);
+    rbt_inorder(&rbt, rbt.root);
+    gettimeofday(&etv, NULL);
+    printf("rbt_inorder %ld: %.1lf ms\n", rbt_test_visited, rbtdtime(&etv, &stv));
+
+    rbt_cursor_init(&rbt, &c);
+    count = 0;
+    gettimeofday(&stv, NULL);
+    for (n = rbt_cursor_first(&c); n != rbt_end(&rbt); n = rbt_cursor_next(&c))
+        count++;
+    gettimeofday(&etv, NULL);
+    printf("cursor next %ld: %.1lf ms\n", count, rbtdtime(&etv, &stv));
+
+    count = 0;
+    gettimeofday(&stv, NULL);
+    for (n = rbt_cursor_last(&c); n != rbt_end(&rbt); n = rbt_cursor_prev(&c))
+        count++;
+    gettimeofday(&etv, NULL);
+    printf("cursor prev %ld: %.1lf ms\n", count, rbtdtime(&etv, &stv));
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < seeks; i++) {
+        tmp.key = hashlittle(&i, sizeof(i), 1) & 0x7fffffff;
+        n = rbt_cursor_lower(&c, &tmp);
+        if (n != rbt_end(&rbt) && n->key < tmp.key)
+            notok++;
+        n = rbt_cursor_prev(&c);
+        if (n != rbt_end(&rbt) && n->key >= tmp.key)
+            notok++;
+    }
+    gettimeofday(&etv, NULL);
+    printf("cursor seek speed: %.0lf, not ok: %ld\n",
+            seeks / rbtdtime(&etv, &stv) * 1000, notok);
+
+    gettimeofday(&stv, NULL);
+    rbt_destroy(&rbt);
+    gettimeofday(&etv, NULL);
+    printf("rbt_destroy %ld: %.1lf ms, size: %lu\n", max,
+            rbtdtime(&etv, &stv), rbt.size);
+}
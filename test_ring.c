@@ -0,0 +1,135 @@
+#include "ring.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define RING_TEST_BURST 32
+
+typedef struct ring_arg_s {
+    ring_t *r;
+    long count;     /* objects per thread */
+    long sum;
+} ring_arg_t;
+
+static void *ring_producer(void *arg)
+{
+    ring_arg_t *a = arg;
+    void *objs[RING_TEST_BURST];
+    long i = 1, n, k;
+
+    while (i <= a->count) {
+        n = a->count - i + 1;
+        if (n > RING_TEST_BURST)
+            n = RING_TEST_BURST;
+
+        for (k = 0; k < n; k++)
+            objs[k] = (void *)(uintptr_t)(i + k);
+
+        /* full, let a consumer run on a busy or single cpu */
+        n = ring_enqueue_burst(a->r, objs, n);
+        if (n == 0)
+            sched_yield();
+        i += n;
+    }
+
+    return NULL;
+}
+
+static void *ring_consumer(void *arg)
+{
+    ring_arg_t *a = arg;
+    void *objs[RING_TEST_BURST];
+    long got = 0, n, k;
+
+    while (got < a->count) {
+        /* never take more than our share, the other consumers need it */
+        n = a->count - got;
+        if (n > RING_TEST_BURST)
+            n = RING_TEST_BURST;
+
+        n = ring_dequeue_burst(a->r, objs, n);
+        if (n == 0)
+            sched_yield();
+        for (k = 0; k < n; k++)
+            a->sum += (long)(uintptr_t)objs[k];
+        got += n;
+    }
+
+    return NULL;
+}
+
+static void ring_bench(const char *name, uint32_t flags, int nthreads)
+{
+    pthread_t prod[nthreads], cons[nthreads];
+    ring_arg_t pa[nthreads], ca[nthreads];
+    struct timeval stv, etv;
+    long count = (1 << 20) / nthreads;
+    long sum = 0;
+    double ms;
+    int i;
+
+    ring_t *r = ring_create(1024, flags);
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < nthreads; i++) {
+        pa[i].r = ca[i].r = r;
+        pa[i].count = ca[i].count = count;
+        pa[i].sum = ca[i].sum = 0;
+        pthread_create(&cons[i], NULL, ring_consumer, &ca[i]);
+        pthread_create(&prod[i], NULL, ring_producer, &pa[i]);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(prod[i], NULL);
+        pthread_join(cons[i], NULL);
+        sum += ca[i].sum;
+    }
+    gettimeofday(&etv, NULL);
+
+    ms = (etv.tv_sec - stv.tv_sec) * 1000.0 +
+        (etv.tv_usec - stv.tv_usec) / 1000.0 + 0.001;
+
+    printf("%s: threads: %d, speed: %.0lf, check: %s\n", name, nthreads,
+            count * nthreads / ms * 1000,
+            sum == (count * (count + 1) / 2) * nthreads ? "ok" : "error");
+
+    ring_free(r);
+}
+
+void test_ring()
+{
+    ring_t *r;
+    void *objs[8];
+    unsigned int bulk, burst, count, deq, left;
+    int full, empty, order = 1;
+    int i;
+
+    r = ring_create(8, 0);
+    for (i = 0; i < 8; i++)
+        objs[i] = (void *)(uintptr_t)(i + 1);
+
+    /* one slot is kept empty, so 8 slots hold 7 */
+    bulk = ring_enqueue_bulk(r, objs, 8);
+    burst = ring_enqueue_burst(r, objs, 8);
+    count = ring_count(r);
+    full = ring_full(r);
+    deq = ring_dequeue_burst(r, objs, 8);
+    left = ring_count(r);
+    empty = ring_empty(r);
+    for (i = 0; i < (int)deq; i++)
+        order &= objs[i] == (void *)(uintptr_t)(i + 1);
+    ring_free(r);
+
+    printf("bulk: %u, burst: %u, count: %u, full: %d, dequeue: %u, "
+            "count: %u, empty: %d, check: %s\n",
+            bulk, burst, count, full, deq, left, empty,
+            bulk == 0 && burst == 7 && count == 7 && full && deq == 7 &&
+            left == 0 && empty && order ? "ok" : "error");
+
+    ring_bench("spsc", RING_F_SP_ENQ | RING_F_SC_DEQ, 1);
+    ring_bench("mpmc", 0, 1);
+    ring_bench("mpmc", 0, 2);
+    ring_bench("mpmc", 0, 4);
+}
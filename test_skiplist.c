@@ -1,5 +1,10 @@
 #include "skiplist.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 skiplist_t sl;
@@ -17,6 +22,837 @@ static unsigned int dtime(struct timeval *x, struct timeval *y)
 }
 
 
+#define SL_TEST_MAX_THREADS 64
+
+typedef struct slarg_s {
+	int sync;	/* 1: skiplist_sync_*, 0: global mutex */
+	long loops;
+	long found;
+	uint64_t seed;
+} slarg_t;
+
+static skiplist_t sl_sync_list;
+static long sl_sync_max = 1 << 20;
+static pthread_mutex_t sl_sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t sl_xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* 90% find, 5% insert, 5% remove */
+static void *sl_worker(void *arg)
+{
+	slarg_t *a = arg;
+	skipnode_t tmp, *n;
+	uint64_t r;
+	long i;
+
+	for (i = 0; i < a->loops; i++) {
+		r = sl_xorshift(&a->seed);
+		tmp.key = (r >> 8) % sl_sync_max;
+
+		if ((r & 0xff) < 230) {
+			if (a->sync) {
+				/* the node may only be read inside the section */
+				skiplist_sync_enter();
+				n = skiplist_sync_find(&sl_sync_list, &tmp);
+				a->found += (n != NULL && n->key == tmp.key);
+				skiplist_sync_exit();
+			} else {
+				pthread_mutex_lock(&sl_sync_mutex);
+				n = skiplist_find(&sl_sync_list, &tmp);
+				a->found += (n != NULL && n->key == tmp.key);
+				pthread_mutex_unlock(&sl_sync_mutex);
+			}
+		} else if ((r & 0xff) < 243) {
+			n = sl_sync_list.alloc(&sl_sync_list,
+					SKIPNODE_SIZE(sl_sync_list.max_level));
+			n->key = tmp.key;
+			n->level = sl_sync_list.random(&sl_sync_list);
+
+			if (a->sync) {
+				if (skiplist_sync_insert(&sl_sync_list, n) != n)
+					sl_sync_list.free(&sl_sync_list, n);
+			} else {
+				pthread_mutex_lock(&sl_sync_mutex);
+				if (skiplist_insert(&sl_sync_list, n) != n)
+					sl_sync_list.free(&sl_sync_list, n);
+				pthread_mutex_unlock(&sl_sync_mutex);
+			}
+		} else if (a->sync) {
+			skiplist_sync_remove(&sl_sync_list, &tmp);
+		} else {
+			pthread_mutex_lock(&sl_sync_mutex);
+			n = skiplist_remove(&sl_sync_list, &tmp);
+			pthread_mutex_unlock(&sl_sync_mutex);
+			if (n)
+				sl_sync_list.clr(n);
+		}
+	}
+
+	skiplist_sync_thread_exit();
+
+	return NULL;
+}
+
+static void sl_bench(int sync, int nthreads, long loops)
+{
+	pthread_t tid[SL_TEST_MAX_THREADS];
+	slarg_t arg[SL_TEST_MAX_THREADS];
+	struct timeval stv, etv;
+	long found = 0;
+	int i;
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < nthreads; i++) {
+		arg[i].sync = sync;
+		arg[i].loops = loops / nthreads;
+		arg[i].found = 0;
+		arg[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		pthread_create(&tid[i], NULL, sl_worker, &arg[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+		found += arg[i].found;
+	}
+	gettimeofday(&etv, NULL);
+
+	printf("%-5s threads: %2d, speed: %d, found: %ld\n",
+			sync ? "sync" : "mutex", nthreads,
+			(int)(loops / nthreads * nthreads / dtime(&etv, &stv) * 1000), found);
+}
+
+/* lock free skiplist against one global mutex */
+void test_skiplist_sync()
+{
+	long loops = 1 << 22;
+	int max = sysconf(_SC_NPROCESSORS_ONLN);
+	skipnode_t *n;
+	long i;
+	int t;
+
+	if (max > SL_TEST_MAX_THREADS)
+		max = SL_TEST_MAX_THREADS;
+
+	skiplist_init(&sl_sync_list, 20);
+	for (i = 0; i < sl_sync_max; i += 2) {
+		n = sl_sync_list.alloc(&sl_sync_list, SKIPNODE_SIZE(sl_sync_list.max_level));
+		n->key = i;
+		n->level = sl_sync_list.random(&sl_sync_list);
+		skiplist_insert(&sl_sync_list, n);
+	}
+
+	for (t = 1; t <= max; t *= 2) {
+		sl_bench(0, t, loops);
+		sl_bench(1, t, loops);
+	}
+
+	skiplist_destroy(&sl_sync_list);
+}
+
+#define SL_STRESS_THREADS 6
+#define SL_STRESS_KEYS    1024
+
+typedef struct slstress_arg_s {
+	long loops;
+	long inserted;	/* successful skiplist_sync_insert */
+	long removed;	/* successful skiplist_sync_remove */
+	uint64_t seed;
+} slstress_arg_t;
+
+/* a small key space so the threads keep racing on the same nodes */
+static void *sl_stress_worker(void *arg)
+{
+	slstress_arg_t *a = arg;
+	skipnode_t tmp, *n;
+	uint64_t r;
+	long i;
+
+	for (i = 0; i < a->loops; i++) {
+		r = sl_xorshift(&a->seed);
+		tmp.key = (r >> 8) % SL_STRESS_KEYS;
+
+		switch (r % 3) {
+		case 0:
+			n = sl_sync_list.alloc(&sl_sync_list,
+					SKIPNODE_SIZE(sl_sync_list.max_level));
+			n->key = tmp.key;
+			n->level = sl_sync_list.random(&sl_sync_list);
+			if (skiplist_sync_insert(&sl_sync_list, n) == n)
+				a->inserted++;
+			else
+				sl_sync_list.free(&sl_sync_list, n);
+			break;
+		case 1:
+			if (skiplist_sync_remove(&sl_sync_list, &tmp) != NULL)
+				a->removed++;
+			break;
+		default:
+			skiplist_sync_find(&sl_sync_list, &tmp);
+			break;
+		}
+
+		if ((r >> 40) % 64 == 0)
+			sched_yield();
+	}
+
+	skiplist_sync_thread_exit();
+
+	return NULL;
+}
+
+/*
+ * racing inserts and removes, then check the list once the threads are
+ * gone: sorted, no duplicate, no marked pointer, no flag left, and the
+ * size matches what the threads did. build skiplist.c with
+ * -DSKIPLIST_SYNC_YIELD to yield before every CAS.
+ */
+void test_skiplist_sync_stress()
+{
+	pthread_t tid[SL_STRESS_THREADS];
+	slstress_arg_t arg[SL_STRESS_THREADS];
+	skipnode_t *n, *next;
+	long initial = 0, expect, count = 0;
+	int unsorted = 0, marked = 0, flagged = 0;
+	long i;
+	int t;
+
+	skiplist_init(&sl_sync_list, 16);
+	for (i = 0; i < SL_STRESS_KEYS; i += 2) {
+		n = sl_sync_list.alloc(&sl_sync_list, SKIPNODE_SIZE(sl_sync_list.max_level));
+		n->key = i;
+		n->level = sl_sync_list.random(&sl_sync_list);
+		skiplist_insert(&sl_sync_list, n);
+		initial++;
+	}
+
+	for (t = 0; t < SL_STRESS_THREADS; t++) {
+		arg[t].loops = 1 << 18;
+		arg[t].inserted = 0;
+		arg[t].removed = 0;
+		arg[t].seed = 0x9E3779B97F4A7C15ULL * (t + 1);
+		pthread_create(&tid[t], NULL, sl_stress_worker, &arg[t]);
+	}
+
+	expect = initial;
+	for (t = 0; t < SL_STRESS_THREADS; t++) {
+		pthread_join(tid[t], NULL);
+		expect += arg[t].inserted - arg[t].removed;
+	}
+
+	for (n = sl_sync_list.head->forward[0]; n != sl_sync_list.null; n = next) {
+		next = n->forward[0];
+		if ((uintptr_t)next & 1) {
+			marked++;
+			break;
+		}
+		if (next != sl_sync_list.null && next->key <= n->key)
+			unsorted++;
+		if (n->level & (SKIPNODE_SYNC_INSERTING | SKIPNODE_SYNC_DELETED))
+			flagged++;
+		count++;
+	}
+
+	printf("sync stress threads: %d, count: %ld, size: %ld, expect: %ld, "
+			"unsorted: %d, marked: %d, flagged: %d, check: %s\n",
+			SL_STRESS_THREADS, count, (long)sl_sync_list.size, expect,
+			unsorted, marked, flagged,
+			count == expect && (long)sl_sync_list.size == expect &&
+			!unsorted && !marked && !flagged ? "ok" : "error");
+
+	skiplist_destroy(&sl_sync_list);
+}
+
+/* the old level generator, glibc random() takes a lock per call */
+static int sl_libc_random(skiplist_t *sl)
+{
+	int level = 1;
+
+	while ((random() & 0xFFFF) < (0xFFFF * SKIPLIST_P / 100))
+		level++;
+
+	if (level > sl->max_level)
+		level = sl->max_level;
+
+	return level;
+}
+
+typedef struct slrand_arg_s {
+	skiplist_t *sl;
+	int id;
+	int nthreads;
+	long loops;
+} slrand_arg_t;
+
+static void *sl_insert_worker(void *arg)
+{
+	slrand_arg_t *a = arg;
+	skipnode_t *n;
+	long i;
+
+	for (i = 0; i < a->loops; i++) {
+		n = a->sl->alloc(a->sl, SKIPNODE_SIZE(a->sl->max_level));
+		n->key = i * a->nthreads + a->id;
+		n->level = a->sl->random(a->sl);
+		skiplist_sync_insert(a->sl, n);
+	}
+
+	skiplist_sync_thread_exit();
+
+	return NULL;
+}
+
+/* level generator: glibc random() against the thread local wyrand */
+void test_skiplist_random()
+{
+	static const char *name[] = { "libc", "wyrand" };
+	skiplist_random_func_t func[] = { sl_libc_random, skiplist_default_random };
+	pthread_t tid[SL_TEST_MAX_THREADS];
+	slrand_arg_t arg[SL_TEST_MAX_THREADS];
+	struct timeval stv, etv;
+	skiplist_t list;
+	long loops = 1 << 22;
+	long count[8];
+	int max = sysconf(_SC_NPROCESSORS_ONLN);
+	int f, t, i;
+
+	if (max > SL_TEST_MAX_THREADS)
+		max = SL_TEST_MAX_THREADS;
+
+	skiplist_init(&list, 20);
+	for (f = 0; f < 2; f++) {
+		for (i = 0; i < 8; i++)
+			count[i] = 0;
+
+		gettimeofday(&stv, NULL);
+		for (i = 0; i < loops; i++)
+			count[func[f](&list) & 7]++;
+		gettimeofday(&etv, NULL);
+
+		printf("%-6s level speed: %d, level 1-4: %.2f%% %.2f%% %.2f%% %.2f%%\n",
+				name[f], (int)(loops / dtime(&etv, &stv) * 1000),
+				count[1] * 100.0 / loops, count[2] * 100.0 / loops,
+				count[3] * 100.0 / loops, count[4] * 100.0 / loops);
+	}
+	skiplist_destroy(&list);
+
+	for (t = 1; t <= max; t *= 2) {
+		for (f = 0; f < 2; f++) {
+			skiplist_init(&list, 20);
+			list.random = func[f];
+
+			gettimeofday(&stv, NULL);
+			for (i = 0; i < t; i++) {
+				arg[i].sl = &list;
+				arg[i].id = i;
+				arg[i].nthreads = t;
+				arg[i].loops = loops / t;
+				pthread_create(&tid[i], NULL, sl_insert_worker, &arg[i]);
+			}
+			for (i = 0; i < t; i++)
+				pthread_join(tid[i], NULL);
+			gettimeofday(&etv, NULL);
+
+			printf("%-6s threads: %2d, insert speed: %d, size: %d\n",
+					name[f], t, (int)(loops / t * t / dtime(&etv, &stv) * 1000),
+					list.size);
+			skiplist_destroy(&list);
+		}
+	}
+}
+
+/* rank and position lookups by the spans against a level 0 walk */
+void test_skiplist_rank()
+{
+	struct timeval stv, etv;
+	skiplist_t list;
+	skipnode_t tmp, *n, *cur;
+	int max = 1 << 21;
+	int walks = 20;
+	int notok = 0;
+	long r;
+	int i;
+
+	skiplist_init(&list, 20);
+	for (i = 0; i < max; i++) {
+		n = list.alloc(&list, SKIPNODE_SIZE(list.max_level));
+		n->key = (i * 2654435761u) % max;
+		n->level = list.random(&list);
+		skiplist_insert(&list, n);
+	}
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		tmp.key = i;
+		if (skiplist_rank(&list, &tmp) != i)
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("rank speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		n = skiplist_at(&list, i);
+		if (n == NULL || n->key != i)
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("at speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < walks; i++) {
+		tmp.key = (i * 2654435761u) % max;
+		r = 0;
+		for (cur = list.head->forward[0]; cur != list.null &&
+				list.cmp(&tmp, cur) != 0; cur = cur->forward[0])
+			r++;
+		if (r != tmp.key)
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("linear rank speed: %d, not ok: %d\n",
+			walks * 1000 / dtime(&etv, &stv), notok);
+
+	skiplist_destroy(&list);
+}
+
+/* calloc/free per node against the node arena */
+void test_skiplist_arena()
+{
+	struct timeval stv, etv;
+	skiplist_t list;
+	skipnode_t tmp, *n;
+	int max = 1 << 23;
+	int level;
+	int arena;
+	int i;
+
+	for (arena = 0; arena <= 1; arena++) {
+		skiplist_init(&list, 20);
+		if (arena)
+			skiplist_arena_init(&list);
+
+		gettimeofday(&stv, NULL);
+		for (i = 0; i < max; i++) {
+			level = list.random(&list);
+			n = list.alloc(&list, SKIPNODE_SIZE(level));
+			n->key = i;
+			n->level = level;
+			skiplist_insert(&list, n);
+		}
+		gettimeofday(&etv, NULL);
+		printf("%-6s insert speed: %d\n", arena ? "arena" : "calloc",
+				max / dtime(&etv, &stv) * 1000);
+
+		/* remove and insert back, the arena reuses its free lists */
+		gettimeofday(&stv, NULL);
+		for (i = 0; i < max; i += 2) {
+			tmp.key = i;
+			n = skiplist_remove(&list, &tmp);
+			level = n->level;
+			list.free(&list, n);
+
+			n = list.alloc(&list, SKIPNODE_SIZE(level));
+			n->key = i;
+			n->level = level;
+			skiplist_insert(&list, n);
+		}
+		gettimeofday(&etv, NULL);
+		printf("%-6s remove and insert speed: %d\n", arena ? "arena" : "calloc",
+				max / 2 / dtime(&etv, &stv) * 1000);
+
+		gettimeofday(&stv, NULL);
+		skiplist_clear(&list);
+		gettimeofday(&etv, NULL);
+		printf("%-6s clear: %u ms\n", arena ? "arena" : "calloc",
+				dtime(&etv, &stv));
+
+		skiplist_destroy(&list);
+	}
+}
+
+/* the same compare as the default one, but reached through sl->cmp */
+static int sl_key64_cmp(skipnode_t *x, skipnode_t *y)
+{
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+ * 64 bits keys: inline compare against a cmp call per step,
+ * on a list which fits in the cache so the compare is what counts.
+ */
+void test_skiplist_key64()
+{
+	static const char *name[] = { "inline", "call" };
+	struct timeval stv, etv;
+	skiplist_t list;
+	skipnode_t tmp, *n;
+	int64_t *keys;
+	uint64_t seed = 88172645463325252ULL;
+	int max = 1 << 10;
+	int loops = 1 << 23;
+	int level;
+	int notok;
+	int f, i;
+
+	keys = calloc(max, sizeof(int64_t));
+	for (i = 0; i < max; i++)
+		keys[i] = (int64_t)sl_xorshift(&seed);
+
+	for (f = 0; f < 2; f++) {
+		skiplist_init(&list, 20);
+		skiplist_arena_init(&list);
+		if (f)
+			list.cmp = sl_key64_cmp;
+
+		for (i = 0; i < max; i++) {
+			level = list.random(&list);
+			n = list.alloc(&list, SKIPNODE_SIZE(level));
+			n->key = keys[i];
+			n->value = &keys[i];
+			n->level = level;
+			skiplist_insert(&list, n);
+		}
+
+		notok = 0;
+		gettimeofday(&stv, NULL);
+		for (i = 0; i < loops; i++) {
+			tmp.key = keys[i & (max - 1)];
+			n = skiplist_find(&list, &tmp);
+			if (n == NULL || n->value != &keys[i & (max - 1)])
+				notok++;
+		}
+		gettimeofday(&etv, NULL);
+		printf("%-6s find speed: %d, not ok: %d\n", name[f],
+				loops / dtime(&etv, &stv) * 1000, notok);
+
+		skiplist_destroy(&list);
+	}
+
+	free(keys);
+}
+
+static long sl_ubytes(uskiplist_t *l)
+{
+	uskipblock_t *b;
+	long bytes = 0;
+
+	for (b = l->head->forward[0]; b != NULL; b = b->forward[0])
+		bytes += USKIPBLOCK_SIZE(b->level);
+
+	return bytes;
+}
+
+/* skiplist with arena vs unrolled skiplist: speed and bytes per key */
+void test_uskiplist()
+{
+	struct timeval stv, etv;
+	skiplist_t list;
+	uskiplist_t ulist;
+	skipnode_t tmp, *n;
+	int64_t *keys;
+	uint64_t seed = 88172645463325252ULL;
+	int max = 1 << 22;
+	int level;
+	int notok;
+	long bytes;
+	int i;
+
+	keys = calloc(max, sizeof(int64_t));
+	for (i = 0; i < max; i++)
+		keys[i] = (int64_t)sl_xorshift(&seed);
+
+	skiplist_init(&list, 20);
+	skiplist_arena_init(&list);
+
+	bytes = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		level = list.random(&list);
+		n = list.alloc(&list, SKIPNODE_SIZE(level));
+		n->key = keys[i];
+		n->value = &keys[i];
+		n->level = level;
+		skiplist_insert(&list, n);
+		bytes += SKIPNODE_SIZE(level);
+	}
+	gettimeofday(&etv, NULL);
+	printf("skiplist  insert speed: %d, %.1lf bytes/key\n",
+			max / dtime(&etv, &stv) * 1000, (double)bytes / max);
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		tmp.key = keys[i];
+		n = skiplist_find(&list, &tmp);
+		if (n == NULL || n->value != &keys[i])
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("skiplist  find speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		tmp.key = keys[i];
+		n = skiplist_remove(&list, &tmp);
+		if (n == NULL)
+			notok++;
+		else
+			list.free(&list, n);
+	}
+	gettimeofday(&etv, NULL);
+	printf("skiplist  remove speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+	skiplist_destroy(&list);
+
+	uskiplist_init(&ulist, 20);
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++)
+		uskiplist_insert(&ulist, keys[i], &keys[i]);
+	gettimeofday(&etv, NULL);
+	printf("uskiplist insert speed: %d, %.1lf bytes/key, %.2lf keys/block\n",
+			max / dtime(&etv, &stv) * 1000,
+			(double)sl_ubytes(&ulist) / ulist.size,
+			(double)ulist.size / ulist.nblock);
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		void *v;
+
+		if (uskiplist_find(&ulist, keys[i], &v) != 0 || v != &keys[i])
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("uskiplist find speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		if (uskiplist_remove(&ulist, keys[i]) != 0)
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("uskiplist remove speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+	uskiplist_destroy(&ulist);
+
+	free(keys);
+}
+
+/* one key at a time vs interleaved batches of 256 keys */
+void test_skiplist_batch()
+{
+	struct timeval stv, etv;
+	skiplist_t list;
+	skipnode_t *tmp, *n;
+	skipnode_t *keys[256], *ret[256];
+	int64_t *data;
+	uint64_t seed = 88172645463325252ULL;
+	int max = 1 << 22;
+	int level;
+	int notok;
+	int i, j;
+
+	data = calloc(max, sizeof(int64_t));
+	tmp = calloc(max, sizeof(skipnode_t));
+	for (i = 0; i < max; i++) {
+		data[i] = (int64_t)sl_xorshift(&seed);
+		tmp[i].key = data[i];
+	}
+
+	skiplist_init(&list, 20);
+	skiplist_arena_init(&list);
+	for (i = 0; i < max; i++) {
+		level = list.random(&list);
+		n = list.alloc(&list, SKIPNODE_SIZE(level));
+		n->key = data[i];
+		n->value = &data[i];
+		n->level = level;
+		skiplist_insert(&list, n);
+	}
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i++) {
+		n = skiplist_find(&list, &tmp[i]);
+		if (n == NULL || n->value != &data[i])
+			notok++;
+	}
+	gettimeofday(&etv, NULL);
+	printf("single find speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	notok = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i += 256) {
+		for (j = 0; j < 256; j++)
+			keys[j] = &tmp[i + j];
+		notok += 256 - skiplist_find_batch(&list, keys, ret, 256);
+		for (j = 0; j < 256; j++) {
+			if (ret[j] && ret[j]->value != &data[i + j])
+				notok++;
+		}
+	}
+	gettimeofday(&etv, NULL);
+	printf("batch  find speed: %d, not ok: %d\n",
+			max / dtime(&etv, &stv) * 1000, notok);
+
+	skiplist_destroy(&list);
+	free(tmp);
+	free(data);
+}
+
+static void sl_range_fill(skiplist_t *sl, int max)
+{
+	skipnode_t *n;
+	int level;
+	int i;
+
+	for (i = 0; i < max; i++) {
+		level = sl->random(sl);
+		n = sl->alloc(sl, SKIPNODE_SIZE(level));
+		n->key = i;
+		n->level = level;
+		skiplist_insert(sl, n);
+	}
+}
+
+#define SL_RANGE_CHECK_MAX (1 << 16)
+
+/*
+ * remove a few ranges, at the head, inside, one key and past the tail,
+ * then the keys left must be found, the removed ones not, and the
+ * spans must still give every node its position.
+ */
+static void sl_range_check(void)
+{
+	static const long range[][2] = {
+		{ 0, 99 }, { 1000, 4999 }, { 30000, 30000 },
+		{ SL_RANGE_CHECK_MAX - 100, SL_RANGE_CHECK_MAX + 100 },
+	};
+	static char gone[SL_RANGE_CHECK_MAX];
+	skiplist_t list;
+	skipnode_t lo, hi, *n;
+	long errors = 0, removed, expect, idx;
+	int i, r;
+
+	skiplist_init(&list, 20);
+	skiplist_arena_init(&list);
+	sl_range_fill(&list, SL_RANGE_CHECK_MAX);
+	memset(gone, 0, sizeof(gone));
+
+	for (r = 0; r < (int)(sizeof(range) / sizeof(range[0])); r++) {
+		lo.key = range[r][0];
+		hi.key = range[r][1];
+		removed = skiplist_remove_range(&list, &lo, &hi);
+
+		expect = 0;
+		for (i = range[r][0]; i <= range[r][1] && i < SL_RANGE_CHECK_MAX; i++) {
+			expect += !gone[i];
+			gone[i] = 1;
+		}
+		if (removed != expect)
+			errors++;
+	}
+
+	/* misses inside the ranges, hits on both edges */
+	for (i = 0; i < SL_RANGE_CHECK_MAX; i++) {
+		lo.key = i;
+		if ((skiplist_find(&list, &lo) == NULL) != gone[i])
+			errors++;
+	}
+
+	idx = 0;
+	for (n = list.head->forward[0]; n != list.null; n = n->forward[0]) {
+		if (skiplist_rank(&list, n) != idx || skiplist_at(&list, idx) != n)
+			errors++;
+		idx++;
+	}
+	if (idx != list.size || skiplist_at(&list, idx) != NULL)
+		errors++;
+
+	printf("remove range check size: %d, errors: %ld, check: %s\n",
+			list.size, errors, errors ? "error" : "ok");
+	skiplist_destroy(&list);
+}
+
+/* expire time ordered keys in windows: remove one by one vs by range */
+void test_skiplist_range()
+{
+	struct timeval stv, etv;
+	skiplist_t list;
+	skiplist_cursor_t c;
+	skipnode_t lo, hi, *n;
+	int max = 1 << 22;
+	int window = 1 << 12;
+	long total, unordered;
+	int i, j;
+
+	skiplist_init(&list, 20);
+	skiplist_arena_init(&list);
+	sl_range_fill(&list, max);
+
+	total = 0;
+	unordered = 0;
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i += window) {
+		lo.key = i;
+		hi.key = i + window - 1;
+		skiplist_cursor_seek(&list, &c, &lo, &hi);
+		while ((n = skiplist_cursor_next(&c)) != NULL) {
+			if (n->key != total)
+				unordered++;
+			total++;
+		}
+	}
+	gettimeofday(&etv, NULL);
+	printf("cursor scan speed: %d, total: %ld, check: %s\n",
+			max / dtime(&etv, &stv) * 1000, total,
+			total == max && !unordered ? "ok" : "error");
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i += window) {
+		for (j = i; j < i + window; j++) {
+			lo.key = j;
+			n = skiplist_remove(&list, &lo);
+			if (n)
+				list.free(&list, n);
+		}
+	}
+	gettimeofday(&etv, NULL);
+	printf("remove one by one: %u ms, size: %d\n",
+			dtime(&etv, &stv), list.size);
+	skiplist_destroy(&list);
+
+	skiplist_init(&list, 20);
+	skiplist_arena_init(&list);
+	sl_range_fill(&list, max);
+
+	gettimeofday(&stv, NULL);
+	for (i = 0; i < max; i += window) {
+		lo.key = i;
+		hi.key = i + window - 1;
+		skiplist_remove_range(&list, &lo, &hi);
+	}
+	gettimeofday(&etv, NULL);
+	printf("remove by range  : %u ms, size: %d\n",
+			dtime(&etv, &stv), list.size);
+	skiplist_destroy(&list);
+
+	sl_range_check();
+}
+
 int main(int argc, char *argv[])
 {
 	struct timeval stv, etv;
@@ -35,7 +871,7 @@ int main(int argc, char *argv[])
 		level = sl.random(&sl);
 		//printf("Insert key: %d, level: %d\n", i, level);
 
-		new = sl.alloc(SKIPNODE_SIZE(level));
+		new = sl.alloc(&sl, SKIPNODE_SIZE(level));
 		new->key = i;
 		new->level = level;
 
@@ -58,7 +894,7 @@ int main(int argc, char *argv[])
 			break;
 		}
 
-		//printf("Find %d, %d\n", i, new->key);
+		//printf("Find %d, %ld\n", i, (long)new->key);
 	}
 	gettimeofday(&etv, NULL);
 	printf("Find speed: %d\n", max / dtime(&etv, &stv) * 1000);
@@ -90,7 +926,7 @@ int main(int argc, char *argv[])
 		printf("Level %d:", i);
 		while (head->forward[i] != sl.null) {
 			head = head->forward[i];
-			printf("%d ", head->key);
+			printf("%ld ", (long)head->key);
 		}
 		printf("\n");
 	}
@@ -0,0 +1,105 @@
+#include "sync.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define SYNC_TEST_MAX_THREADS 64
+
+enum sync_lock_type_e {
+    SYNC_SPIN,
+    SYNC_TICKET,
+    SYNC_MCS,
+    SYNC_MUTEX
+};
+
+typedef struct sync_arg_s {
+    int type;
+    long loops;
+} sync_arg_t;
+
+static spinlock_t       test_spin = SPINLOCK_INIT;
+static ticketlock_t     test_ticket = TICKETLOCK_INIT;
+static mcslock_t        test_mcs = MCSLOCK_INIT;
+static pthread_mutex_t  test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile long    test_counter;
+
+static void *sync_worker(void *arg)
+{
+    sync_arg_t *a = arg;
+    mcs_node_t me;
+    long i;
+
+    for (i = 0; i < a->loops; i++) {
+        switch (a->type) {
+        case SYNC_SPIN:
+            spin_lock(&test_spin);
+            test_counter++;
+            spin_unlock(&test_spin);
+            break;
+        case SYNC_TICKET:
+            ticket_lock(&test_ticket);
+            test_counter++;
+            ticket_unlock(&test_ticket);
+            break;
+        case SYNC_MCS:
+            mcs_lock(&test_mcs, &me);
+            test_counter++;
+            mcs_unlock(&test_mcs, &me);
+            break;
+        default:
+            pthread_mutex_lock(&test_mutex);
+            test_counter++;
+            pthread_mutex_unlock(&test_mutex);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void sync_bench(const char *name, int type, int nthreads, long loops)
+{
+    pthread_t tid[SYNC_TEST_MAX_THREADS];
+    sync_arg_t arg;
+    struct timeval stv, etv;
+    double ms;
+    int i;
+
+    arg.type = type;
+    arg.loops = loops / nthreads;
+    test_counter = 0;
+
+    gettimeofday(&stv, NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tid[i], NULL, sync_worker, &arg);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+    gettimeofday(&etv, NULL);
+
+    ms = (etv.tv_sec - stv.tv_sec) * 1000.0 +
+        (etv.tv_usec - stv.tv_usec) / 1000.0 + 0.001;
+
+    printf("%-6s threads: %2d, speed: %.0lf, check: %s\n", name, nthreads,
+            arg.loops * nthreads / ms * 1000,
+            test_counter == arg.loops * nthreads ? "ok" : "error");
+}
+
+/* acquisition throughput of every lock at 1..N threads */
+void test_sync()
+{
+    long loops = 1 << 22;
+    int max = sysconf(_SC_NPROCESSORS_ONLN);
+    int n;
+
+    if (max > SYNC_TEST_MAX_THREADS)
+        max = SYNC_TEST_MAX_THREADS;
+
+    for (n = 1; n <= max; n *= 2) {
+        sync_bench("spin", SYNC_SPIN, n, loops);
+        sync_bench("ticket", SYNC_TICKET, n, loops);
+        sync_bench("mcs", SYNC_MCS, n, loops);
+        sync_bench("mutex", SYNC_MUTEX, n, loops);
+        printf("-------------------------------------------\n");
+    }
+}
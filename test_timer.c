@@ -0,0 +1,201 @@
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static double tmdtime(struct timeval *x, struct timeval *y)
+{
+    return (x->tv_sec - y->tv_sec) * 1000.0 +
+        (x->tv_usec - y->tv_usec) / 1000.0 + 0.001;
+}
+
+static inline uint64_t tm_xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void tm_timeout(timer_mgr_t *tm, timer_event_t *ev)
+{
+    (void)tm;
+    /* the connection is closed, it comes back as a new one */
+    (*(long *)ev->data)++;
+}
+
+/*
+ * connection timeouts: every request re-arms the timeout of its
+ * connection, so most timers are cancelled before they fire.
+ * 90% of the timeouts are short, 10% are long keepalives.
+ */
+void test_timer()
+{
+    struct timeval stv, etv;
+    timer_mgr_t tm;
+    timer_event_t *ev;
+    rbtree_key_t now, timeout;
+    uint64_t seed, r;
+    long nconn = 1 << 18;
+    long loops = 1 << 23;
+    long fired;
+    long i, c;
+    int wheel;
+
+    ev = calloc(nconn, sizeof(timer_event_t));
+
+    for (wheel = 0; wheel <= 1; wheel++) {
+        seed = 88172645463325252ULL;
+        now = 0;
+        fired = 0;
+        timer_init(&tm, now);
+        timer_set_wheel(&tm, wheel);
+
+        for (c = 0; c < nconn; c++) {
+            ev[c].where = TIMER_IDLE;
+            ev[c].handler = tm_timeout;
+            ev[c].data = &fired;
+            timer_add(&tm, &ev[c], 60000);
+        }
+
+        gettimeofday(&stv, NULL);
+        for (i = 0; i < loops; i++) {
+            r = tm_xorshift(&seed);
+            c = r % nconn;
+            if ((r >> 40) % 10 == 0)
+                timeout = 30000 + (r >> 20) % 30000;
+            else
+                timeout = 100 + (r >> 20) % 3000;
+            timer_add(&tm, &ev[c], timeout);
+
+            /* one ms every 256 requests */
+            if ((i & 255) == 255) {
+                timer_expire(&tm, ++now);
+            }
+        }
+        gettimeofday(&etv, NULL);
+
+        printf("wheel: %d, re-arm speed: %.0lf, fired: %ld, wheel: %lu, "
+                "tree: %lu\n", wheel, loops / tmdtime(&etv, &stv) * 1000,
+                fired, tm.nwheel, tm.ntree);
+
+        for (c = 0; c < nconn; c++) {
+            timer_del(&tm, &ev[c]);
+        }
+    }
+
+    free(ev);
+}
+
+typedef struct tmcheck_s {
+    timer_event_t ev;
+    rbtree_key_t due;       /* earliest time it may fire */
+    int armed;
+} tmcheck_t;
+
+static long tm_errors;
+static rbtree_key_t tm_prev;    /* time of the expire before this one */
+
+static void tm_check_fire(timer_mgr_t *tm, timer_event_t *ev)
+{
+    tmcheck_t *c = container_of(ev, tmcheck_t, ev);
+
+    /*
+     * not cancelled, not early, and not late: a wheel timer may fire up
+     * to a tick late, so the expire before this one was still too early.
+     */
+    if (!c->armed || (rbtree_key_int_t) (tm->now - c->due) < 0 ||
+            (rbtree_key_int_t) (tm_prev - c->due) >= TIMER_WHEEL_TICK) {
+        tm_errors++;
+    }
+    c->armed = 0;
+}
+
+/*
+ * random add, re-arm, cancel and expire against the expected due
+ * times, then cancel every tree timer and drain the wheel.
+ */
+void test_timer_check()
+{
+    timer_mgr_t tm;
+    tmcheck_t *c;
+    rbtree_key_t now = 0, timeout;
+    uint64_t seed = 88172645463325252ULL, r;
+    long n = 1 << 12;
+    long loops = 1 << 20;
+    long i, k, armed;
+
+    c = calloc(n, sizeof(tmcheck_t));
+    tm_errors = 0;
+    tm_prev = now;
+
+    /* the min was left on a cancelled event when the root changed */
+    timer_init(&tm, now);
+    c[0].ev.handler = tm_check_fire;
+    c[1].ev.handler = tm_check_fire;
+    timer_add(&tm, &c[0].ev, TIMER_WHEEL_SPAN + 1000);
+    timer_add(&tm, &c[1].ev, TIMER_WHEEL_SPAN + 2000);
+    timer_del(&tm, &c[0].ev);
+    timer_del(&tm, &c[1].ev);
+    if (tm.min != NULL || timer_next(&tm) != TIMER_INFINITE ||
+            timer_expire(&tm, now + 100000) != 0)
+        tm_errors++;
+
+    timer_init(&tm, now);
+
+    for (i = 0; i < loops; i++) {
+        r = tm_xorshift(&seed);
+        k = r % n;
+        c[k].ev.handler = tm_check_fire;
+
+        switch ((r >> 20) % 8) {
+        case 0:
+            timer_del(&tm, &c[k].ev);
+            c[k].armed = 0;
+            break;
+        case 1:
+            now += (r >> 24) % 16;
+            timer_expire(&tm, now);
+            tm_prev = now;
+            break;
+        default:
+            /* a third of the timers are long enough for the tree */
+            if ((r >> 32) % 3 == 0)
+                timeout = TIMER_WHEEL_SPAN + (r >> 40) % 10000;
+            else
+                timeout = (r >> 40) % TIMER_WHEEL_SPAN;
+            timer_add(&tm, &c[k].ev, timeout);
+            c[k].due = now + timeout;
+            c[k].armed = 1;
+            break;
+        }
+
+        if (timer_next(&tm) == TIMER_INFINITE && tm.nwheel + tm.ntree)
+            tm_errors++;
+    }
+
+    /* cancel every tree timer, the cached min must go with them */
+    for (k = 0; k < n; k++) {
+        if (c[k].ev.where == TIMER_IN_TREE) {
+            timer_del(&tm, &c[k].ev);
+            c[k].armed = 0;
+        }
+    }
+    if (tm.ntree != 0 || tm.min != NULL)
+        tm_errors++;
+
+    /* everything left fires once */
+    while (tm.nwheel) {
+        now += 1 + (tm_xorshift(&seed) % 4);
+        timer_expire(&tm, now);
+        tm_prev = now;
+    }
+    armed = 0;
+    for (k = 0; k < n; k++)
+        armed += c[k].armed;
+
+    printf("timer check: errors: %ld, missed: %ld, next: %ld\n",
+            tm_errors, armed, (long) timer_next(&tm));
+
+    free(c);
+}
@@ -0,0 +1,257 @@
+#include "timer.h"
+
+#define TIMER_WHEEL_WORDS   (TIMER_WHEEL_SLOTS / 64)
+
+#define _timer_slot(t)      (((t) / TIMER_WHEEL_TICK) & (TIMER_WHEEL_SLOTS - 1))
+#define _timer_round_down(t) ((t) & ~(rbtree_key_t) (TIMER_WHEEL_TICK - 1))
+#define _timer_round_up(t)  _timer_round_down((t) + TIMER_WHEEL_TICK - 1)
+
+/* a <= b with wraparound */
+#define _timer_before_eq(a, b) ((rbtree_key_int_t) ((a) - (b)) <= 0)
+
+void timer_init(timer_mgr_t *tm, rbtree_key_t now)
+{
+    int i;
+
+    rbtree_init(&tm->tree, &tm->sentinel, rbtree_insert_timer_value);
+    tm->min = NULL;
+
+    tm->now = now;
+    tm->tick = _timer_round_down(now) + TIMER_WHEEL_TICK;
+    tm->wheel_on = 1;
+
+    tm->nwheel = 0;
+    tm->ntree = 0;
+
+    for (i = 0; i < TIMER_WHEEL_WORDS; i++) {
+        tm->busy[i] = 0;
+    }
+
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        INIT_LIST_HEAD(&tm->wheel[i]);
+    }
+}
+
+void timer_set_wheel(timer_mgr_t *tm, int on)
+{
+    tm->wheel_on = on;
+}
+
+static rbtree_node_t *_timer_tree_next(timer_mgr_t *tm, rbtree_node_t *n)
+{
+    rbtree_node_t *p;
+
+    if (n->right != tm->tree.sentinel) {
+        return rbtree_min(n->right, tm->tree.sentinel);
+    }
+
+    /*
+     * stop at the root, not at a NULL parent: rbtree_delete does not
+     * reset the parent of a node that becomes the root.
+     */
+    for ( ;; ) {
+        if (n == tm->tree.root) {
+            return NULL;
+        }
+
+        p = n->parent;
+        if (n == p->left) {
+            return p;
+        }
+
+        n = p;
+    }
+}
+
+/* slots from slot to the first busy one, -1 if the wheel is empty */
+static int _timer_wheel_first(timer_mgr_t *tm, int slot)
+{
+    uint64_t bits;
+    int i, w;
+
+    for (i = 0; i <= TIMER_WHEEL_WORDS; i++) {
+        w = (slot / 64 + i) % TIMER_WHEEL_WORDS;
+        bits = tm->busy[w];
+
+        if (i == 0) {
+            bits &= ~0ULL << (slot % 64);
+        } else if (i == TIMER_WHEEL_WORDS) {
+            /* back to the first word, the bits before slot */
+            bits &= (1ULL << (slot % 64)) - 1;
+        }
+
+        if (bits) {
+            return (w * 64 + __builtin_ctzll(bits) - slot) &
+                (TIMER_WHEEL_SLOTS - 1);
+        }
+    }
+
+    return -1;
+}
+
+void timer_add(timer_mgr_t *tm, timer_event_t *ev, rbtree_key_t timeout)
+{
+    rbtree_key_t key = tm->now + timeout;
+    rbtree_key_t t;
+    int slot;
+
+    if (ev->where != TIMER_IDLE) {
+        timer_del(tm, ev);
+    }
+
+    if (tm->wheel_on && timeout < TIMER_WHEEL_SPAN) {
+        /* the slot whose tick ends at or after key */
+        t = _timer_round_up(key);
+        if (!_timer_before_eq(tm->tick, t)) {
+            t = tm->tick;
+        }
+
+        if ((rbtree_key_int_t) (t - tm->tick) < TIMER_WHEEL_SPAN) {
+            slot = _timer_slot(t);
+            ev->node.key = t;
+            list_add_tail(&ev->list, &tm->wheel[slot]);
+            tm->busy[slot / 64] |= 1ULL << (slot % 64);
+            ev->where = TIMER_IN_WHEEL;
+            tm->nwheel++;
+            return;
+        }
+    }
+
+    ev->node.key = key;
+    rbtree_insert(&tm->tree, &ev->node);
+    ev->where = TIMER_IN_TREE;
+    tm->ntree++;
+
+    /* an equal key goes to the right, the cached min stays */
+    if (tm->min == NULL || (rbtree_key_int_t) (key - tm->min->key) < 0) {
+        tm->min = &ev->node;
+    }
+}
+
+void timer_del(timer_mgr_t *tm, timer_event_t *ev)
+{
+    int slot;
+
+    switch (ev->where) {
+    case TIMER_IN_WHEEL:
+        slot = _timer_slot(ev->node.key);
+        list_del(&ev->list);
+        if (list_empty(&tm->wheel[slot])) {
+            tm->busy[slot / 64] &= ~(1ULL << (slot % 64));
+        }
+        tm->nwheel--;
+        break;
+
+    case TIMER_IN_TREE:
+        if (tm->min == &ev->node) {
+            tm->min = _timer_tree_next(tm, &ev->node);
+        }
+        rbtree_delete(&tm->tree, &ev->node);
+        tm->ntree--;
+        break;
+
+    case TIMER_EXPIRING:
+        list_del(&ev->list);
+        break;
+
+    default:
+        return;
+    }
+
+    ev->where = TIMER_IDLE;
+}
+
+rbtree_key_int_t timer_next(timer_mgr_t *tm)
+{
+    rbtree_key_int_t next = TIMER_INFINITE;
+    rbtree_key_int_t d;
+    int slots;
+
+    if (tm->nwheel) {
+        slots = _timer_wheel_first(tm, _timer_slot(tm->tick));
+        next = (rbtree_key_int_t) (tm->tick - tm->now) +
+            (rbtree_key_int_t) slots * TIMER_WHEEL_TICK;
+    }
+
+    if (tm->min) {
+        /* an overdue timer is due now, keep -1 for TIMER_INFINITE */
+        d = (rbtree_key_int_t) (tm->min->key - tm->now);
+        if (d < 0) {
+            d = 0;
+        }
+        if (next == TIMER_INFINITE || d < next) {
+            next = d;
+        }
+    }
+
+    return next;
+}
+
+unsigned long timer_expire(timer_mgr_t *tm, rbtree_key_t now)
+{
+    rbtree_node_t *batch[TIMER_EXPIRE_BATCH];
+    rbtree_node_t *n;
+    struct list_head expired;
+    timer_event_t *ev;
+    unsigned long fired = 0;
+    rbtree_key_t t;
+    int slot, k, i;
+
+    INIT_LIST_HEAD(&expired);
+    tm->now = now;
+
+    /* whole slots of the wheel, skipping the empty ones by the bitmap */
+    while (tm->nwheel && _timer_before_eq(tm->tick, now)) {
+        t = tm->tick + (rbtree_key_t) _timer_wheel_first(tm,
+                _timer_slot(tm->tick)) * TIMER_WHEEL_TICK;
+        if (!_timer_before_eq(t, now)) {
+            break;
+        }
+
+        slot = _timer_slot(t);
+        list_for_each_entry(ev, &tm->wheel[slot], list) {
+            ev->where = TIMER_EXPIRING;
+            tm->nwheel--;
+        }
+        list_splice_tail_init(&tm->wheel[slot], &expired);
+        tm->busy[slot / 64] &= ~(1ULL << (slot % 64));
+        tm->tick = t + TIMER_WHEEL_TICK;
+    }
+
+    if (_timer_before_eq(tm->tick, now)) {
+        tm->tick = _timer_round_down(now) + TIMER_WHEEL_TICK;
+    }
+
+    /*
+     * the due nodes of the tree are the leftmost ones, walk them in
+     * order and unlink a batch, the node after the batch is the new min.
+     */
+    while (tm->min && _timer_before_eq(tm->min->key, now)) {
+        n = tm->min;
+        for (k = 0; k < TIMER_EXPIRE_BATCH && n != NULL &&
+                _timer_before_eq(n->key, now); k++) {
+            batch[k] = n;
+            n = _timer_tree_next(tm, n);
+        }
+        tm->min = n;
+
+        for (i = 0; i < k; i++) {
+            rbtree_delete(&tm->tree, batch[i]);
+            ev = container_of(batch[i], timer_event_t, node);
+            ev->where = TIMER_EXPIRING;
+            list_add_tail(&ev->list, &expired);
+        }
+        tm->ntree -= k;
+    }
+
+    /* a handler may cancel a timer still waiting on this list */
+    while (!list_empty(&expired)) {
+        ev = list_first_entry(&expired, timer_event_t, list);
+        list_del(&ev->list);
+        ev->where = TIMER_IDLE;
+        fired++;
+        ev->handler(tm, ev);
+    }
+
+    return fired;
+}
@@ -0,0 +1,86 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "rbtree.h"
+#include "list.h"
+#include <stdint.h>
+
+/*
+ * timer manager, times are milliseconds in rbtree_key_t and compared
+ * with wraparound like rbtree_insert_timer_value.
+ *
+ * a timer due within TIMER_WHEEL_SPAN goes to a hashed timing wheel,
+ * O(1) add and cancel, it fires at the end of its tick so it may be
+ * up to TIMER_WHEEL_TICK late but never early. a longer timer goes
+ * to the rbtree, whose leftmost node is cached so the next expiry is
+ * O(1). most connection timeouts are short and get cancelled before
+ * they fire, they never touch the tree.
+ */
+#define TIMER_WHEEL_SLOTS   512     /* power of two */
+#define TIMER_WHEEL_TICK    8       /* ms, power of two */
+#define TIMER_WHEEL_SPAN    (TIMER_WHEEL_SLOTS * TIMER_WHEEL_TICK)
+#define TIMER_EXPIRE_BATCH  64      /* tree timers unlinked per round */
+
+#define TIMER_INFINITE      ((rbtree_key_int_t) -1)
+
+typedef struct timer_event_s timer_event_t;
+typedef struct timer_mgr_s timer_mgr_t;
+
+typedef void (*timer_handler_pt)(timer_mgr_t *tm, timer_event_t *ev);
+
+enum timer_where_e {
+    TIMER_IDLE,
+    TIMER_IN_WHEEL,
+    TIMER_IN_TREE,
+    TIMER_EXPIRING      /* unlinked, its handler runs in this expire */
+};
+
+struct timer_event_s {
+    rbtree_node_t node;     /* node.key is the expiry time */
+    struct list_head list;  /* wheel slot or the expiring list */
+    timer_handler_pt handler;
+    void *data;
+    int where;
+};
+
+struct timer_mgr_s {
+    rbtree_t tree;
+    rbtree_node_t sentinel;
+    rbtree_node_t *min;     /* leftmost node of the tree, NULL if empty */
+
+    rbtree_key_t now;       /* time of the last timer_expire */
+    rbtree_key_t tick;      /* end of the next slot to expire */
+    int wheel_on;
+
+    unsigned long nwheel;
+    unsigned long ntree;
+
+    uint64_t busy[TIMER_WHEEL_SLOTS / 64];  /* slots not empty */
+    struct list_head wheel[TIMER_WHEEL_SLOTS];
+};
+
+/* an event must be zeroed before its first timer_add */
+void timer_init(timer_mgr_t *tm, rbtree_key_t now);
+
+/* off puts every timer in the tree, call it before the first add */
+void timer_set_wheel(timer_mgr_t *tm, int on);
+
+static inline int timer_is_set(timer_event_t *ev)
+{
+    return ev->where == TIMER_IN_WHEEL || ev->where == TIMER_IN_TREE;
+}
+
+/* arm ev to fire timeout ms after tm->now, a set timer is re-armed */
+void timer_add(timer_mgr_t *tm, timer_event_t *ev, rbtree_key_t timeout);
+void timer_del(timer_mgr_t *tm, timer_event_t *ev);
+
+/* ms from tm->now to the next expiry, 0 if due, TIMER_INFINITE if none */
+rbtree_key_int_t timer_next(timer_mgr_t *tm);
+
+/*
+ * advance to now and run the handlers of the due timers,
+ * a handler may add or cancel any timer. return how many fired.
+ */
+unsigned long timer_expire(timer_mgr_t *tm, rbtree_key_t now);
+
+#endif // TIMER_H